@@ -30,17 +30,48 @@
 #endif
 
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 #include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/param.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <fcntl.h>
+#ifdef HAVE_LINUX_UDMABUF_H
+# include <sys/ioctl.h>
+# include <linux/dma-buf.h>
+# include <linux/udmabuf.h>
+#endif
 
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 #include <X11/Xatom.h>
+#ifdef HAVE_XRANDR
+# include <X11/extensions/Xrandr.h>
+#endif
+#ifdef HAVE_XCB_PRESENT
+# include <X11/Xlib-xcb.h>
+# include <xcb/present.h>
+#endif
 
 #include <vlc_common.h>
 #include <vlc_plugin.h>
@@ -49,6 +80,7 @@
 #include <vlc_opengl.h>
 
 #include <vlc/libvlc.h>
+#include <vlc/libvlc_version.h>
 
 #ifndef N_
 #define N_(x) x
@@ -63,7 +95,9 @@
 #define PROVIDER_LONGTEXT N_("Extension through which to use the OpenGL ES2.")
 
 #define CHROMA_TEXT N_("Chroma used")
-#define CHROMA_LONGTEXT N_("Force use of a specific chroma for output. Default is I420.")
+#define CHROMA_LONGTEXT N_("Force use of a specific chroma for output " \
+	"(I420, I422, I444 or GREY). Default is the chroma of the video, or " \
+	"the closest of those.")
 
 #define DISPLAY_TEXT N_("X11 display")
 #define DISPLAY_LONGTEXT N_( \
@@ -75,7 +109,147 @@
 	"Video will be embedded in this pre-existing window. " \
 	"If zero, a new window will be created.")
 
+#define CLONES_TEXT N_("Number of cloned windows")
+#define CLONES_LONGTEXT N_( \
+	"Render the video into this many additional windows. Upload and " \
+	"conversion happen once, only the scaling is done per window.")
+
+#define PIP_TEXT N_("Picture-in-picture inset")
+#define PIP_LONGTEXT N_( \
+	"Do not open a window, draw the video as an inset of the first " \
+	"OpenGL ES2 video output instead.")
+
+#define PIP_SIZE_TEXT N_("Picture-in-picture size")
+#define PIP_SIZE_LONGTEXT N_( \
+	"Width of the inset relative to the width of the main video.")
+
+#define DMABUF_TEXT N_("Use dma-buf backed pictures")
+#define DMABUF_LONGTEXT N_( \
+	"Decode into dma-bufs and let the GPU sample them directly instead " \
+	"of uploading every picture. Needs /dev/udmabuf and " \
+	"EGL_EXT_image_dma_buf_import.")
+
+#define CHAIN_TEXT N_("Post-processing shader chain")
+#define CHAIN_LONGTEXT N_( \
+	"Colon separated list of GLSL fragment shader files run on the " \
+	"converted picture before scaling. Each one gets the previous result " \
+	"as sampler2D s_tex, the size of one texel as vec2 texel_size and " \
+	"the coordinates as varying vec2 vTexcoord. Files are reloaded when " \
+	"they change. With gles2-stats the time of each pass is shown.")
+
+#define REFRESH_TEXT N_("Match display refresh rate")
+#define REFRESH_LONGTEXT N_( \
+	"Switch the display to the mode whose refresh rate suits the frame " \
+	"rate of the video best (e.g. 24Hz or 48Hz for film) while playing, " \
+	"and restore the previous mode afterwards. Needs XRandR.")
+
+#define PRESENT_TEXT N_("Schedule frames with the X Present extension")
+#define PRESENT_LONGTEXT N_( \
+	"Render into pixmaps and queue each one for the vblank closest to " \
+	"the picture date instead of swapping as soon as possible.")
+
+#define IVTC_TEXT N_("Inverse telecine")
+#define IVTC_LONGTEXT N_( \
+	"Detect 3:2 pulled-down film in interlaced video, rebuild the " \
+	"progressive frames from matching fields and drop the repeated ones " \
+	"instead of blending the fields. Each frame waits for the GPU to " \
+	"measure its fields.")
+
+#define STATS_TEXT N_("Show statistics")
+#define STATS_LONGTEXT N_( \
+	"Draw frame rate, late and dropped frames, stage times and the " \
+	"upload path " \
+	"on top of the video.")
+
+#define FLAT_CHROMA_TEXT N_("Detect grey I420")
+#define FLAT_CHROMA_LONGTEXT N_( \
+	"Upload and convert only the luma plane while the chroma planes " \
+	"of the pictures stay neutral.")
+
+#define ANALYTICS_TEXT N_("Content analytics")
+#define ANALYTICS_LONGTEXT N_( \
+	"Measure the mean luma and the motion of every picture on the GPU " \
+	"and report black and frozen video through the gles2-luma, " \
+	"gles2-motion, gles2-black and gles2-frozen variables.")
+
+#define AUTOCROP_TEXT N_("Crop black bars")
+#define AUTOCROP_LONGTEXT N_( \
+	"Detect black bars around the picture every few seconds and show " \
+	"only the active part of it.")
+
+#define LUT_TEXT N_("3D LUT")
+#define LUT_LONGTEXT N_( \
+	"Path to a .cube 3D LUT applied to the colours right after the " \
+	"YUV to RGB conversion.")
+
+#define DENOISE_TEXT N_("Temporal denoise")
+#define DENOISE_LONGTEXT N_( \
+	"How much of the previous picture is blended into still parts of " \
+	"the current one, 0 disables the denoiser.")
+
+#define SHARPEN_TEXT N_("Sharpen")
+#define SHARPEN_LONGTEXT N_( \
+	"Strength of the luma sharpening done while scaling, 0 disables it.")
+
+#define LOW_LATENCY_TEXT N_("Low latency")
+#define LOW_LATENCY_LONGTEXT N_( \
+	"Render into the front buffer where the driver allows it, else " \
+	"swap without waiting for vsync and with one frame in flight at " \
+	"most. Trades tearing for latency.")
+
+#define RT_PRIORITY_TEXT N_("Real-time priority")
+#define RT_PRIORITY_LONGTEXT N_( \
+	"Real-time priority of the thread displaying the pictures, 0 keeps " \
+	"the normal scheduling. Lowered to RLIMIT_RTPRIO if not permitted.")
+
+#define RT_POLICY_TEXT N_("Real-time policy")
+#define RT_POLICY_LONGTEXT N_( \
+	"Scheduling policy used with a real-time priority, fifo or rr.")
+
+#define CPUS_TEXT N_("CPUs")
+#define CPUS_LONGTEXT N_( \
+	"Pin the thread displaying the pictures to these CPUs, as a list " \
+	"like 2,3 or 2-3.")
+
+#define METRICS_TEXT N_("Metrics socket")
+#define METRICS_LONGTEXT N_( \
+	"Path of a UNIX socket serving the counters of this display in the " \
+	"Prometheus text format, over HTTP or to plain readers.")
+
+#define SOAK_TEXT N_("Soak test")
+#define SOAK_LONGTEXT N_( \
+	"Track frame time percentiles, the resident memory and the GL " \
+	"objects of the display every minute and resize the window every " \
+	"few minutes. Each drift is logged as a line starting with " \
+	"\"ERR: soak: FAILED\", closing the display logs " \
+	"\"MSG: soak: passed\" or \"ERR: soak: FAILED\" again.")
+
+#define WALL_TEXT N_("Video wall tile")
+#define WALL_LONGTEXT N_( \
+	"Show only one tile of a video wall, as COLUMNSxROWS+COLUMN+ROW " \
+	"counted from 0, e.g. 3x2+1+0 for the top middle screen.")
+
+#define WALL_SYNC_TEXT N_("Video wall swap sync")
+#define WALL_SYNC_LONGTEXT N_( \
+	"Hold every swap until the other screens of the wall got there: " \
+	"shm:/name between processes of one host, removed by the last " \
+	"screen to close, or udp:address:port between hosts, with a " \
+	"multicast or broadcast address.")
+
+#define HDR_TEXT N_("HDR to SDR")
+#define HDR_LONGTEXT N_( \
+	"Tone map HDR video for SDR displays in the conversion: auto " \
+	"follows the transfer function of the video (VLC 3 and later), " \
+	"pq or hlg force it, off disables it.")
+
+#define HDR_PEAK_TEXT N_("HDR peak luminance")
+#define HDR_PEAK_LONGTEXT N_( \
+	"Peak luminance of the content in nits, mapped to the white of the " \
+	"display. The mastering metadata of the video takes precedence.")
+
 #define MEASURE_TIME 0
+#define MAX_CHAIN_PASSES 8
+#define MAX_CLONES 4
 
 static int Open( vlc_object_t * );
 static void Close( vlc_object_t * );
@@ -94,6 +268,43 @@ vlc_module_begin ()
     add_string("x11-display", NULL, DISPLAY_TEXT, DISPLAY_LONGTEXT, true)
     add_integer("drawable-xid", 0, XID_TEXT, XID_LONGTEXT, true)
         change_volatile ()
+    add_integer_with_range("gles2-clones", 0, 0, MAX_CLONES,
+                           CLONES_TEXT, CLONES_LONGTEXT, true)
+    add_bool("gles2-pip", false, PIP_TEXT, PIP_LONGTEXT, true)
+    add_float_with_range("gles2-pip-size", 0.25, 0.1, 0.5,
+                         PIP_SIZE_TEXT, PIP_SIZE_LONGTEXT, true)
+    add_bool("gles2-dmabuf", false, DMABUF_TEXT, DMABUF_LONGTEXT, true)
+    add_string("gles2-shader-chain", NULL, CHAIN_TEXT, CHAIN_LONGTEXT, true)
+    add_string("gles2-lut", NULL, LUT_TEXT, LUT_LONGTEXT, true)
+    add_float_with_range("gles2-denoise", 0.0, 0.0, 0.9,
+                         DENOISE_TEXT, DENOISE_LONGTEXT, true)
+    add_float_with_range("gles2-sharpen", 0.0, 0.0, 2.0,
+                         SHARPEN_TEXT, SHARPEN_LONGTEXT, true)
+    add_bool("gles2-low-latency", false, LOW_LATENCY_TEXT,
+             LOW_LATENCY_LONGTEXT, true)
+    add_integer_with_range("gles2-rt-priority", 0, 0, 99,
+                           RT_PRIORITY_TEXT, RT_PRIORITY_LONGTEXT, true)
+    add_string("gles2-rt-policy", "fifo", RT_POLICY_TEXT,
+               RT_POLICY_LONGTEXT, true)
+    add_string("gles2-cpus", NULL, CPUS_TEXT, CPUS_LONGTEXT, true)
+    add_string("gles2-metrics", NULL, METRICS_TEXT, METRICS_LONGTEXT, true)
+    add_bool("gles2-soak", false, SOAK_TEXT, SOAK_LONGTEXT, true)
+    add_string("gles2-wall", NULL, WALL_TEXT, WALL_LONGTEXT, true)
+    add_string("gles2-wall-sync", NULL, WALL_SYNC_TEXT,
+               WALL_SYNC_LONGTEXT, true)
+    add_string("gles2-hdr", "auto", HDR_TEXT, HDR_LONGTEXT, true)
+    add_float_with_range("gles2-hdr-peak", 1000.0, 203.0, 10000.0,
+                         HDR_PEAK_TEXT, HDR_PEAK_LONGTEXT, true)
+#ifdef HAVE_XRANDR
+    add_bool("gles2-refresh-match", false, REFRESH_TEXT, REFRESH_LONGTEXT, true)
+#endif
+    add_bool("gles2-present", false, PRESENT_TEXT, PRESENT_LONGTEXT, true)
+    add_bool("gles2-ivtc", false, IVTC_TEXT, IVTC_LONGTEXT, true)
+    add_bool("gles2-stats", false, STATS_TEXT, STATS_LONGTEXT, true)
+    add_bool("gles2-flat-chroma", false, FLAT_CHROMA_TEXT,
+             FLAT_CHROMA_LONGTEXT, true)
+    add_bool("gles2-analytics", false, ANALYTICS_TEXT, ANALYTICS_LONGTEXT, true)
+    add_bool("gles2-autocrop", false, AUTOCROP_TEXT, AUTOCROP_LONGTEXT, true)
 
 vlc_module_end ()
 
@@ -103,7 +314,14 @@ vlc_module_end ()
  *****************************************************************************/
 enum shader_types {
 	SHADER_TYPE_DEINT_LINEAR,
-	SHADER_TYPE_COPY
+	SHADER_TYPE_COPY,
+	SHADER_TYPE_CUSTOM,
+	SHADER_TYPE_IVTC_WEAVE,
+	SHADER_TYPE_IVTC_METRIC,
+	SHADER_TYPE_OVERLAY,
+	SHADER_TYPE_GREY,
+	SHADER_TYPE_ANALYTICS,
+	SHADER_TYPE_CROP
 };
 
 typedef struct rectangle_t {
@@ -126,22 +344,105 @@ typedef struct {
 	GLint  texcoord_loc;
 } gl_shader_t;
 
+/* user supplied post-processing pass, see shader_chain_load() */
+typedef struct {
+	char        *path;
+	time_t      mtime;
+	gl_shader_t shader;
+	GLint       tex_loc;
+	GLint       texel_loc;
+	mtime_t     time;
+} shader_pass_t;
+
 typedef struct opengl_es2_t {
 	GLuint       framebuffer;
 	gl_shader_t  deint;
+	gl_shader_t  grey;  /* deint for the Y plane alone */
 	gl_shader_t  scale;
+	gl_shader_t  copy;  /* plain scale when that one sharpens */
 	gl_texture_t tex[3];  /* y,u,v textures */
 	gl_texture_t rgb_tex; /* the rgb output */
+	GLuint       output_tex; /* what do_scaling() shows */
+
+	/* post-processing passes, ping-ponging between two targets */
+	shader_pass_t chain[MAX_CHAIN_PASSES];
+	unsigned      chain_len;
+	GLuint        chain_framebuffer[2];
+	GLuint        chain_tex[2];
+	GLfloat       chain_texel[2];
+	mtime_t       chain_check;
 
 	rectangle_t viewport;
+	rectangle_t clone_viewport[MAX_CLONES];
+	/* the part of the picture converted and shown, in picture pixels */
+	rectangle_t crop;
 	/* do we have support for GL_UNPACK_ROW_LENGTH */
 	bool has_unpack_row;
+
+	/* inverse telecine: previous planes, field weaving and metrics */
+	GLuint      prev_tex[3];
+	gl_shader_t weave;
+	gl_shader_t metric;
+	GLuint      metric_framebuffer;
+	GLuint      metric_tex;
+
+	/* where do_scaling() draws to, 0 is the window */
+	GLuint target_framebuffer;
+
+	/* second render target of a picture-in-picture inset */
+	GLuint back_framebuffer;
+	GLuint back_tex;
+
+	/* GL_OES_EGL_image, to sample imported dma-bufs */
+	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture;
+	/* GL_EXT_discard_framebuffer, spares tilers loads and stores */
+	PFNGLDISCARDFRAMEBUFFEREXTPROC discard_framebuffer;
+
+	/* precision of the built-in programs, see shader_precision_init() */
+	char        header[64];
+	/* variant of the conversion programs, and the LUT it may sample */
+	char        defines[128];
+	GLuint      lut_tex;
+	GLfloat     lut_size;
+
+	/* temporal denoise: the last conversion, swapped with framebuffer */
+	GLfloat     denoise;
+	GLuint      hist_framebuffer;
+	GLuint      hist_tex;
+
+	/* strength of the sharpening scaler variant */
+	GLfloat     sharpen;
+
+	/* peak of HDR content in nits, 0 for SDR */
+	GLfloat     hdr_peak;
 } opengl_es2_t;
 
 typedef struct egl_backend_t {
 	EGLDisplay display;
 	EGLSurface surface;
 	EGLContext context;
+	EGLConfig  config;
+	EGLSurface clones[MAX_CLONES];
+	/* display and config are borrowed from another output */
+	bool       shared;
+
+	/* EGL_KHR_image_base and the image sources we use */
+	bool                     has_dmabuf_import;
+	bool                     has_image_pixmap;
+	PFNEGLCREATEIMAGEKHRPROC  create_image;
+	PFNEGLDESTROYIMAGEKHRPROC destroy_image;
+
+	/* EGL_KHR_fence_sync, to order work between shared contexts */
+	PFNEGLCREATESYNCKHRPROC     create_sync;
+	PFNEGLDESTROYSYNCKHRPROC    destroy_sync;
+	PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync;
+
+	/* how the main surface gets a frame on screen */
+	enum {
+		LATENCY_NORMAL,
+		LATENCY_SINGLE_BUFFER,  /* drawn straight into the front buffer */
+		LATENCY_NO_VSYNC,       /* swapped at once, then waited for */
+	} latency;
 } egl_backend_t;
 
 typedef struct x11_backend_t {
@@ -149,18 +450,399 @@ typedef struct x11_backend_t {
 	Window      window;
 	rectangle_t rect;
 	bool        external;
+	/* the connection outlives us, a picture-in-picture inset uses it */
+	bool        keep_display;
+
+	/* additional windows showing the same video */
+	unsigned    num_clones;
+	Window      clones[MAX_CLONES];
+	rectangle_t clone_rect[MAX_CLONES];
+
+#ifdef HAVE_XRANDR
+	/* mode to restore after refresh rate matching */
+	RRCrtc      randr_crtc;
+	RRMode      randr_mode;
+#endif
 } x11_backend_t;
 
+#ifdef HAVE_XCB_PRESENT
+#define PRESENT_PIXMAPS 3
+#define PRESENT_TIMEOUT (CLOCK_FREQ / 5)  /* longest wait for an idle one */
+
+typedef struct present_buffer_t {
+	Pixmap      pixmap;
+	EGLImageKHR image;
+	GLuint      tex;
+	GLuint      framebuffer;
+	bool        busy;
+	uint32_t    serial;
+	uint64_t    target;
+	mtime_t     date;
+} present_buffer_t;
+
+/*
+ * Presentation through the X Present extension. Every frame is rendered
+ * into one of a few pixmaps, which is queued for the vblank closest to the
+ * picture date. Completion events tell when it really reached the screen
+ * and keep the vblank clock estimate up to date.
+ */
+typedef struct present_t {
+	xcb_connection_t    *conn;
+	xcb_special_event_t *events;
+	uint32_t            eid;
+	present_buffer_t    buf[PRESENT_PIXMAPS];
+	unsigned            width;
+	unsigned            height;
+	uint32_t            serial;
+
+	uint64_t            last_msc;
+	mtime_t             last_ust;
+	mtime_t             period;
+
+	/* presentation error against the picture date, logged every second */
+	unsigned            presented;
+	unsigned            skipped;
+	unsigned            missed;
+	mtime_t             error_sum;
+	mtime_t             error_max;
+	mtime_t             report;
+} present_t;
+#endif
+
+#define IVTC_GRID  16
+#define IVTC_CYCLE 5
+
+/*
+ * 3:2 pulldown state. Film frames A B C D are spread over five video
+ * frames as AA BB BC CD DD (top, bottom field). Weaving each top field
+ * with the bottom field of the current or the previous frame, whichever
+ * combs less, gives A B B C D, and the frame whose top field repeats the
+ * previous one is dropped once the cadence is stable.
+ */
+typedef struct ivtc_t {
+	unsigned frame;
+	float    dup[IVTC_CYCLE];
+	int      phase;   /* position of the repeated frame in the cycle */
+	unsigned locked;  /* cycles the phase has been stable for */
+	unsigned dropped;
+} ivtc_t;
+
+#define ANALYTICS_GRID   16
+#define ANALYTICS_DELAY  3  /* frames between a reduction and its readback */
+#define ANALYTICS_BLACK  32 /* brightest block of a black picture */
+#define ANALYTICS_FROZEN 50 /* pictures without motion to be frozen */
+
+/*
+ * Black and frozen picture detection. Luma is reduced to block means on
+ * the GPU into a ring of small targets, each read back ANALYTICS_DELAY
+ * pictures later. glReadPixels() still waits for everything submitted
+ * before it, so the read happens before the next picture is submitted,
+ * when the GPU finished the target long ago and has little left to do.
+ */
+typedef struct analytics_t {
+	gl_shader_t shader;
+	GLuint      framebuffer[ANALYTICS_DELAY];
+	GLuint      tex[ANALYTICS_DELAY];
+	bool        pending[ANALYTICS_DELAY];  /* reduced, not read back */
+	unsigned    frame;
+
+	GLubyte     prev[ANALYTICS_GRID * ANALYTICS_GRID];
+	bool        has_prev;
+	unsigned    still;
+	bool        black;
+	bool        frozen;
+} analytics_t;
+
+#define CROP_GRID     128
+#define CROP_BLACK    32  /* brightest sample of a black bar */
+#define CROP_MIN      4   /* thinner bars are left alone, in grid cells */
+#define CROP_STABLE   3   /* detections before the crop grows */
+#define CROP_INTERVAL (CLOCK_FREQ * 2)
+
+/*
+ * Black bar detection. Every CROP_INTERVAL the brightest luma of each cell
+ * of a CROP_GRID x CROP_GRID grid is drawn, and read back with the next
+ * picture. Bounds are in grid cells: top, bottom, left, right.
+ */
+typedef struct autocrop_t {
+	gl_shader_t shader;
+	GLuint      framebuffer;
+	GLuint      tex;
+	mtime_t     next;
+	bool        pending;
+
+	unsigned    candidate[4];
+	unsigned    stable;
+	unsigned    current[4];
+	GLubyte     rgba[CROP_GRID * CROP_GRID * 4];
+} autocrop_t;
+
+enum stats_stages {
+	STAGE_CONVERT,  /* upload and conversion */
+	STAGE_POST,     /* post-processing chain */
+	STAGE_SCALE,    /* scaling and swap */
+	STAGE_COUNT
+};
+
+#define STATS_CHARS   224
+#define STATS_REFRESH (CLOCK_FREQ / 4)
+
+/*
+ * On-screen statistics. The numbers are accumulated for every frame, but
+ * the text is only laid out again every STATS_REFRESH, into one vertex
+ * array drawn with a single call.
+ */
+typedef struct stats_t {
+	unsigned    frames;
+	unsigned    late;
+	unsigned    dropped;  /* not shown, e.g. 3:2 repeats */
+	mtime_t     stage[STAGE_COUNT];
+	mtime_t     since;
+
+	gl_shader_t shader;
+	GLuint      font;
+	GLint       font_loc;
+	GLfloat     vertices[STATS_CHARS * 6 * 4];
+	unsigned    count;
+} stats_t;
+
+/*
+ * Scheduling of the thread calling do_display(). It is only known once the
+ * first picture arrives, the previous policy and affinity are restored on
+ * close. Preemptions during do_display() and pictures finished more than a
+ * frame after their date are logged every second.
+ */
+typedef struct sched_t {
+	pthread_t          thread;
+	bool               applied;
+	int                policy;
+	int                priority;
+	cpu_set_t          cpus;
+	bool               pin;
+
+	int                old_policy;
+	struct sched_param old_param;
+	cpu_set_t          old_cpus;
+	bool               pinned;
+
+	mtime_t            period;
+	long               begin;
+	unsigned           frames;
+	unsigned           preempted;
+	unsigned           late;
+	long               switches;
+	mtime_t            report;
+} sched_t;
+
+/*
+ * Counters served on a UNIX socket by a thread of their own. do_display()
+ * only does relaxed atomic updates, the thread formats whatever it reads.
+ */
+typedef struct metrics_t {
+	char                 *path;
+	int                  fd;
+	int                  wake[2];
+	vlc_thread_t         thread;
+
+	atomic_uint_fast64_t displayed;
+	atomic_uint_fast64_t dropped;
+	atomic_uint_fast64_t late;
+	atomic_uint_fast64_t stage[STAGE_COUNT];  /* in us */
+	atomic_uint_fast64_t resizes;
+	atomic_uint_fast64_t gpu_memory;
+	_Atomic(const char *) upload;
+	atomic_bool          luma_only;
+} metrics_t;
+
+#define SOAK_SAMPLES  8192
+#define SOAK_WINDOW   (60 * CLOCK_FREQ)
+#define SOAK_RESIZE   5     /* windows between two resizes */
+#define SOAK_BASES    16
+#define SOAK_KEY      192
+
+/*
+ * Long running drift and leak checks. Frame times are collected for one
+ * window, the first one is a warm up and the second one is the baseline
+ * of this display. Memory and GL objects are compared to the first display
+ * of the process with the same configuration, so leaks across reopening
+ * show up as well, without mistaking another feature set for one.
+ */
+typedef struct soak_t {
+	uint32_t    samples[SOAK_SAMPLES];  /* frame times in us */
+	unsigned    count;
+	unsigned    windows;
+	mtime_t     window_end;
+	uint32_t    base_p99;
+	rectangle_t size;  /* of the window before the resizes */
+	unsigned    failures;
+} soak_t;
+
+#define WALL_SCREENS 64
+#define WALL_MARGIN  2                   /* texels the filters reach out */
+#define WALL_TIMEOUT (CLOCK_FREQ / 20)   /* longest wait for the others */
+#define WALL_ABSENT  CLOCK_FREQ          /* silent screens are left out */
+#define WALL_MAGIC   VLC_FOURCC('G', 'W', 'A', 'L')
+
+/* last swap of a screen and when it was announced */
+typedef struct wall_slot_t {
+	atomic_uint_fast64_t frame;
+	atomic_int_fast64_t  seen;
+} wall_slot_t;
+
+typedef struct wall_packet_t {
+	uint32_t magic;
+	uint32_t screen;
+	uint64_t frame;
+} wall_packet_t;
+
+/*
+ * One screen of a video wall. Only its tile of the picture is uploaded,
+ * converted and shown. Every swap waits until all live screens announced
+ * the same swap count, through slots in shared memory or UDP datagrams.
+ * A screen joining or falling behind catches up with the highest count.
+ */
+typedef struct wall_t {
+	unsigned    cols, rows;
+	unsigned    screen;
+	/* plane sizes the textures were allocated with */
+	unsigned    width[3], height[3];
+	/* rows of the tile, repacked without GL_UNPACK_ROW_LENGTH */
+	uint8_t     *scratch;
+	size_t      scratch_size;
+
+	enum {
+		WALL_SYNC_NONE,
+		WALL_SYNC_SHM,
+		WALL_SYNC_UDP,
+	} sync;
+	wall_slot_t *slots;  /* mapped, or filled from the datagrams */
+	char        *shm_name;
+	int          fd;
+	struct sockaddr_in group;
+	uint64_t     frame;
+
+	unsigned     swaps;
+	unsigned     timeouts;
+	mtime_t      wait_max;
+	mtime_t      report;
+} wall_t;
+
 typedef struct vout_display_sys_t {
 	vout_display_t *vd;
 	x11_backend_t  *x11;
 	egl_backend_t  *egl;
 	opengl_es2_t   *gl;
 	picture_pool_t *pool;
+	ivtc_t         *ivtc;
+	stats_t        *stats;
+	analytics_t    *analytics;
+	autocrop_t     *autocrop;
+	sched_t        *sched;
+	metrics_t      *metrics;
+	soak_t         *soak;
+	wall_t         *wall;
+	/* only the Y plane is uploaded and converted */
+	bool           luma_only;
+	bool           flat_chroma_check;
+	unsigned       flat_frames;
+	/* rendered as inset of another output, see pip_link_t */
+	bool           is_inset;
+#ifdef HAVE_XCB_PRESENT
+	present_t      *present;
+#endif
+	/* pictures of the pool are dma-buf backed, see picture_sys_t */
+	picture_sys_t  **dmabufs;
+	unsigned       num_dmabufs;
+
+	/* first frame vs. steady state timing */
+	unsigned       frames;
+	mtime_t        first_frame;
+	mtime_t        steady;
+
+	/* low latency mode: arrival to finished frame, reported each second */
+	unsigned       latency_frames;
+	mtime_t        latency_sum;
+	mtime_t        latency_max;
+	mtime_t        late_sum;
+	mtime_t        latency_report;
 } vout_display_sys_t;
 
 
+/*
+ * Link between the main output and a picture-in-picture inset. Both run in
+ * different vout threads, the inset uses a context shared with the main
+ * output and publishes its converted texture here, the main output draws
+ * it in do_scaling() before its swap.
+ *
+ * The inset renders into two targets in turn. It does not render into the
+ * one the main output is drawing from (reading), and waits for the fence
+ * the main output leaves behind its reads before reusing a target.
+ */
+typedef struct pip_link_t {
+	vlc_mutex_t         lock;
+	vlc_cond_t          wait;
+	vout_display_sys_t *host;
+	vout_display_sys_t *inset;
+	GLuint              texture;
+	GLuint              reading;
+	EGLSyncKHR          fence;
+	float               aspect;
+	float               size;
+
+	/* displays of a closed main output, closed by the inset using them */
+	vout_display_sys_t *orphan_owner;
+	EGLDisplay          orphan_egl;
+	Display            *orphan_x11;
+} pip_link_t;
+
+static pip_link_t pip = {
+	.lock  = VLC_STATIC_MUTEX,
+	.wait  = VLC_STATIC_COND,
+	.fence = EGL_NO_SYNC_KHR,
+};
+
+/* soak baselines of the process, one per configuration of a display */
+static struct {
+	vlc_mutex_t lock;
+	unsigned    count;
+	struct {
+		char     key[SOAK_KEY];
+		long     rss;
+		int      objects;
+	} base[SOAK_BASES];
+} soak_base = {
+	.lock = VLC_STATIC_MUTEX,
+};
+
+/*
+ * GL objects created and not deleted yet on this thread. A display creates,
+ * uses and deletes its objects in its vout thread, where its context is
+ * current, so this is the count of that display alone.
+ */
+static __thread int gl_objects;
+
+#ifdef HAVE_LINUX_UDMABUF_H
+/*
+ * Picture memory shared with the GPU. The decoder writes into the mapping,
+ * the conversion pass samples the planes through EGLImages imported from
+ * the dma-buf. The imports are created on first use and kept as long as
+ * the buffer lives.
+ */
+struct picture_sys_t {
+	vout_display_sys_t *owner;
+	int         memfd;
+	int         dmabuf;
+	void        *base;
+	size_t      size;
+	size_t      offset[PICTURE_PLANE_MAX];
+	EGLImageKHR image[PICTURE_PLANE_MAX];
+	GLuint      tex[PICTURE_PLANE_MAX];
+	bool        cpu_access;  /* between DMA_BUF_SYNC_START and END */
+};
+#endif
+
 static void update_bounding_box(const vout_display_cfg_t *cfg,
+				double crop_aspect,
 				const rectangle_t *dst,
 				rectangle_t *res)
 {
@@ -172,7 +854,7 @@ static void update_bounding_box(const vout_display_cfg_t *cfg,
 	src.width = cfg->display.width;
 	src.height = cfg->display.height;
 
-	src_ratio = (double)src.width / src.height;
+	src_ratio = (double)src.width / src.height * crop_aspect;
 	dst_ratio = (double)dst->width / dst->height;
 
 	if (src_ratio > dst_ratio) {
@@ -192,11 +874,205 @@ static void update_bounding_box(const vout_display_cfg_t *cfg,
 	}
 }
 
+#ifdef HAVE_XRANDR
+static double randr_mode_refresh(const XRRScreenResources *res, RRMode id)
+{
+	for (int i = 0; i < res->nmode; i++) {
+		const XRRModeInfo *m = &res->modes[i];
+		double vtotal = m->vTotal;
+
+		if (m->id != id)
+			continue;
+		if (!m->hTotal || !m->vTotal)
+			return 0.;
+
+		if (m->modeFlags & RR_DoubleScan)
+			vtotal *= 2;
+		if (m->modeFlags & RR_Interlace)
+			vtotal /= 2;
+		return m->dotClock / (m->hTotal * vtotal);
+	}
+	return 0.;
+}
+
+static const XRRModeInfo *randr_mode_info(const XRRScreenResources *res,
+					  RRMode id)
+{
+	for (int i = 0; i < res->nmode; i++)
+		if (res->modes[i].id == id)
+			return &res->modes[i];
+	return NULL;
+}
+
+/*
+ * How badly a refresh rate shows the given frame rate: 0 if every frame is
+ * shown for the same number of refreshes, up to 0.5 for 3:2 like cadences.
+ */
+static double randr_cadence_error(double refresh, double fps)
+{
+	double ratio = refresh / fps;
+	double repeat = floor(ratio + 0.5);
+
+	if (repeat < 1.)
+		return 1.;
+	return fabs(ratio - repeat) / repeat;
+}
+
+/* the crtc showing the center of our window */
+static RRCrtc randr_find_crtc(x11_backend_t *x11, XRRScreenResources *res)
+{
+	Window child;
+	int cx, cy;
+	RRCrtc crtc = None;
+
+	XTranslateCoordinates(x11->display, x11->window,
+			      DefaultRootWindow(x11->display),
+			      x11->rect.width / 2, x11->rect.height / 2,
+			      &cx, &cy, &child);
+
+	for (int i = 0; i < res->ncrtc && crtc == None; i++) {
+		XRRCrtcInfo *ci = XRRGetCrtcInfo(x11->display, res, res->crtcs[i]);
+
+		if (ci && ci->mode != None && cx >= ci->x && cy >= ci->y &&
+		    cx < ci->x + (int)ci->width && cy < ci->y + (int)ci->height)
+			crtc = res->crtcs[i];
+		if (ci)
+			XRRFreeCrtcInfo(ci);
+	}
+	return crtc;
+}
+
+/*
+ * Switch the crtc showing the window to the mode of the same size whose
+ * refresh rate fits the frame rate of the video best.
+ */
+static void x11_refresh_match(x11_backend_t *x11, const video_format_t *f)
+{
+	XRRScreenResources *res;
+	XRRCrtcInfo *ci = NULL;
+	XRROutputInfo *oi = NULL;
+	const XRRModeInfo *cur;
+	RRMode best;
+	double fps, best_err, refresh;
+	int event, error;
+
+	if (!f->i_frame_rate || !f->i_frame_rate_base)
+		return;
+	fps = (double)f->i_frame_rate / f->i_frame_rate_base;
+
+	XLockDisplay(x11->display);
+	if (!XRRQueryExtension(x11->display, &event, &error)) {
+		fprintf(stderr, "ERR: %s: no XRandR\n", __func__);
+		goto out;
+	}
+
+	res = XRRGetScreenResourcesCurrent(x11->display,
+					   DefaultRootWindow(x11->display));
+	if (!res)
+		goto out;
+
+	x11->randr_crtc = randr_find_crtc(x11, res);
+	if (x11->randr_crtc == None)
+		goto out_res;
+
+	ci = XRRGetCrtcInfo(x11->display, res, x11->randr_crtc);
+	if (!ci || ci->noutput < 1)
+		goto out_res;
+	oi = XRRGetOutputInfo(x11->display, res, ci->outputs[0]);
+	cur = randr_mode_info(res, ci->mode);
+	if (!oi || !cur)
+		goto out_res;
+
+	refresh = randr_mode_refresh(res, ci->mode);
+	best = ci->mode;
+	best_err = randr_cadence_error(refresh, fps);
+	fprintf(stderr, "MSG: display at %.3fHz for %.3ffps video\n",
+		refresh, fps);
+
+	for (int i = 0; i < oi->nmode; i++) {
+		const XRRModeInfo *m = randr_mode_info(res, oi->modes[i]);
+		double err;
+
+		if (!m || m->width != cur->width || m->height != cur->height ||
+		    (m->modeFlags & RR_Interlace))
+			continue;
+
+		/* only switch for a clearly better cadence */
+		err = randr_cadence_error(randr_mode_refresh(res, m->id), fps);
+		if (err + 0.001 < best_err) {
+			best = m->id;
+			best_err = err;
+		}
+	}
+
+	if (best == ci->mode)
+		goto out_res;
+
+	if (XRRSetCrtcConfig(x11->display, res, x11->randr_crtc, CurrentTime,
+			     ci->x, ci->y, best, ci->rotation,
+			     ci->outputs, ci->noutput) != Success) {
+		fprintf(stderr, "ERR: %s: XRRSetCrtcConfig failed\n", __func__);
+		goto out_res;
+	}
+	x11->randr_mode = ci->mode;
+	fprintf(stderr, "MSG: switched display to %.3fHz\n",
+		randr_mode_refresh(res, best));
+
+out_res:
+	if (oi)
+		XRRFreeOutputInfo(oi);
+	if (ci)
+		XRRFreeCrtcInfo(ci);
+	XRRFreeScreenResources(res);
+out:
+	XUnlockDisplay(x11->display);
+}
+
+static void x11_refresh_restore(x11_backend_t *x11)
+{
+	XRRScreenResources *res;
+	XRRCrtcInfo *ci;
+
+	if (x11->randr_mode == None)
+		return;
+
+	XLockDisplay(x11->display);
+	res = XRRGetScreenResourcesCurrent(x11->display,
+					   DefaultRootWindow(x11->display));
+	ci = res ? XRRGetCrtcInfo(x11->display, res, x11->randr_crtc) : NULL;
+	if (ci) {
+		XRRSetCrtcConfig(x11->display, res, x11->randr_crtc, CurrentTime,
+				 ci->x, ci->y, x11->randr_mode, ci->rotation,
+				 ci->outputs, ci->noutput);
+		XRRFreeCrtcInfo(ci);
+	}
+	if (res)
+		XRRFreeScreenResources(res);
+	XSync(x11->display, False);
+	XUnlockDisplay(x11->display);
+
+	x11->randr_mode = None;
+}
+#endif
+
 static void x11_backend_destroy(x11_backend_t *x11)
 {
 	if (!x11)
 		return;
 
+#ifdef HAVE_XRANDR
+	if (x11->display)
+		x11_refresh_restore(x11);
+#endif
+
+	if (x11->num_clones) {
+		XLockDisplay(x11->display);
+		for (unsigned i = 0; i < x11->num_clones; i++)
+			XDestroyWindow(x11->display, x11->clones[i]);
+		x11->num_clones = 0;
+		XUnlockDisplay(x11->display);
+	}
+
 	if (x11->window) {
 		XLockDisplay(x11->display);
 		if (!x11->external)
@@ -208,7 +1084,8 @@ static void x11_backend_destroy(x11_backend_t *x11)
 	}
 
 	if (x11->display) {
-		XCloseDisplay(x11->display);
+		if (!x11->keep_display)
+			XCloseDisplay(x11->display);
 		x11->display = NULL;
 	}
 
@@ -216,6 +1093,29 @@ static void x11_backend_destroy(x11_backend_t *x11)
 	x11 = NULL;
 }
 
+/* how much a crop changes the aspect ratio of the picture */
+static double crop_aspect(const vout_display_sys_t *sys)
+{
+	const video_format_t *f = &sys->vd->fmt;
+	const rectangle_t *crop = &sys->gl->crop;
+
+	if (!crop->width || !crop->height)
+		return 1.0;
+	return ((double)crop->width / f->i_width) /
+	       ((double)crop->height / f->i_height);
+}
+
+static void update_viewports(vout_display_sys_t *sys,
+			     const vout_display_cfg_t *cfg)
+{
+	const double aspect = crop_aspect(sys);
+
+	update_bounding_box(cfg, aspect, &sys->x11->rect, &sys->gl->viewport);
+	for (unsigned i = 0; i < sys->x11->num_clones; i++)
+		update_bounding_box(cfg, aspect, &sys->x11->clone_rect[i],
+				    &sys->gl->clone_viewport[i]);
+}
+
 static void x11_backend_handle_events(vout_display_sys_t *sys)
 {
 	x11_backend_t *x11 = sys->x11;
@@ -223,16 +1123,60 @@ static void x11_backend_handle_events(vout_display_sys_t *sys)
 
 	while (XPending(x11->display)) {
 		XNextEvent(x11->display, &xev);
-		if (xev.type == ConfigureNotify) {
+		if (xev.type != ConfigureNotify)
+			continue;
+
+		if (xev.xconfigure.window == x11->window) {
 			x11->rect.width = xev.xconfigure.width;
 			x11->rect.height = xev.xconfigure.height;
 
-			update_bounding_box(sys->vd->cfg, &x11->rect,
-					    &sys->gl->viewport);
+			update_bounding_box(sys->vd->cfg, crop_aspect(sys),
+					    &x11->rect, &sys->gl->viewport);
+			continue;
+		}
+
+		for (unsigned i = 0; i < x11->num_clones; i++) {
+			if (xev.xconfigure.window != x11->clones[i])
+				continue;
+
+			x11->clone_rect[i].width = xev.xconfigure.width;
+			x11->clone_rect[i].height = xev.xconfigure.height;
+
+			update_bounding_box(sys->vd->cfg, crop_aspect(sys),
+					    &x11->clone_rect[i],
+					    &sys->gl->clone_viewport[i]);
 		}
 	}
 }
 
+static Window x11_create_window(Display *display, const rectangle_t *rect)
+{
+	XSetWindowAttributes swa;
+	XWMHints hints;
+	Window window;
+
+	swa.event_mask = (StructureNotifyMask | ExposureMask
+			  | VisibilityChangeMask);
+
+	window = XCreateWindow(display, DefaultRootWindow(display),
+			       rect->x, rect->y, rect->width, rect->height, 0,
+			       CopyFromParent, InputOutput,
+			       CopyFromParent, CWEventMask,
+			       &swa);
+
+	XSetWindowBackgroundPixmap(display, window, None);
+
+	hints.input = True;
+	hints.flags = InputHint;
+
+	XSetWMHints(display, window, &hints);
+	XMapWindow(display, window);
+	XFlush(display);
+
+	XStoreName(display, window, "VLC OpenGL ES2");
+	return window;
+}
+
 static int x11_backend_create(x11_backend_t **x11, vout_window_cfg_t *cfg, vout_display_t *vd)
 {
 	x11_backend_t *x;
@@ -280,28 +1224,16 @@ static int x11_backend_create(x11_backend_t **x11, vout_window_cfg_t *cfg, vout_
 			     &border, &depth);
 		XFlush(x->display);
 	} else {
-		XSetWindowAttributes swa;
-		XWMHints hints;
-
-		swa.event_mask = (StructureNotifyMask | ExposureMask
-				  | VisibilityChangeMask);
-
-		x->window = XCreateWindow(x->display, root, x->rect.x, x->rect.y,
-					  x->rect.width, x->rect.height, 0,
-					  CopyFromParent, InputOutput,
-					  CopyFromParent, CWEventMask,
-					  &swa);
-
-		XSetWindowBackgroundPixmap(x->display, x->window, None);
-
-		hints.input = True;
-		hints.flags = InputHint;
-
-		XSetWMHints(x->display, x->window, &hints);
-		XMapWindow(x->display, x->window);
-		XFlush(x->display);
+		x->window = x11_create_window(x->display, &x->rect);
+	}
 
-		XStoreName(x->display, x->window, "VLC OpenGL ES2");
+	x->num_clones = var_InheritInteger(vd, "gles2-clones");
+	if (x->num_clones > MAX_CLONES)
+		x->num_clones = MAX_CLONES;
+	for (unsigned i = 0; i < x->num_clones; i++) {
+		x->clone_rect[i] = x->rect;
+		x->clone_rect[i].x = x->clone_rect[i].y = 0;
+		x->clones[i] = x11_create_window(x->display, &x->clone_rect[i]);
 	}
 
 	XUnlockDisplay(x->display);
@@ -324,28 +1256,77 @@ static void egl_backend_destroy(egl_backend_t *egl)
 		return;
 
 	if (egl->context) {
+		eglMakeCurrent(egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+			       EGL_NO_CONTEXT);
 		eglDestroyContext(egl->display, egl->context);
 		egl->context = NULL;
 	}
+	for (unsigned i = 0; i < MAX_CLONES; i++) {
+		if (egl->clones[i]) {
+			eglDestroySurface(egl->display, egl->clones[i]);
+			egl->clones[i] = NULL;
+		}
+	}
 	if (egl->surface) {
 		eglDestroySurface(egl->display, egl->surface);
 		egl->surface = NULL;
 	}
 	if (egl->display) {
-		eglTerminate(egl->display);
+		if (!egl->shared)
+			eglTerminate(egl->display);
 		egl->display = NULL;
 	}
 	free(egl);
 	egl = NULL;
 }
 
-static int egl_backend_create(egl_backend_t **egl, x11_backend_t *x11)
+/*
+ * Get the main surface to the glass as fast as possible: switch a mutable
+ * surface to single buffering, or fall back to swapping without vsync.
+ */
+static void egl_low_latency(egl_backend_t *e, bool mutable_buffer)
+{
+	EGLint buffer = EGL_BACK_BUFFER;
+
+	if (mutable_buffer &&
+	    eglSurfaceAttrib(e->display, e->surface, EGL_RENDER_BUFFER,
+			     EGL_SINGLE_BUFFER))
+		buffer = EGL_SINGLE_BUFFER;
+	else
+		eglQuerySurface(e->display, e->surface, EGL_RENDER_BUFFER,
+				&buffer);
+
+	if (buffer == EGL_SINGLE_BUFFER) {
+		e->latency = LATENCY_SINGLE_BUFFER;
+	} else {
+		eglSwapInterval(e->display, 0);
+		e->latency = LATENCY_NO_VSYNC;
+	}
+	fprintf(stderr, "MSG: low latency: %s\n",
+		e->latency == LATENCY_SINGLE_BUFFER ? "single buffered" :
+		"no vsync, one frame in flight");
+}
+
+static int egl_backend_create(egl_backend_t **egl, x11_backend_t *x11,
+			      bool low_latency)
 {
 	const EGLint cfg_attr[] = {
 		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
 		EGL_BUFFER_SIZE, 24,
 		EGL_NONE
 	};
+	const EGLint mutable_attr[] = {
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_BUFFER_SIZE, 24,
+		EGL_SURFACE_TYPE, EGL_WINDOW_BIT | EGL_MUTABLE_RENDER_BUFFER_BIT_KHR,
+		EGL_NONE
+	};
+	/* honoured by some platforms without the mutable extension */
+	const EGLint single_attr[] = {
+		EGL_RENDER_BUFFER, EGL_SINGLE_BUFFER,
+		EGL_NONE
+	};
+	bool mutable_buffer = false;
 	const EGLint ctx_attr[] = {
 		EGL_CONTEXT_CLIENT_VERSION, 2,
 		EGL_NONE
@@ -356,7 +1337,7 @@ static int egl_backend_create(egl_backend_t **egl, x11_backend_t *x11)
 	EGLConfig cfg;
 	EGLint num;
 
-	e = malloc(sizeof(*e));
+	e = calloc(1, sizeof(*e));
 	if (unlikely(e == NULL)) {
 		fprintf(stderr, "ERR: %s: malloc failed\n", __func__);
 		return VLC_ENOMEM;
@@ -380,6 +1361,38 @@ static int egl_backend_create(egl_backend_t **egl, x11_backend_t *x11)
 //		eglQueryString(e->display, EGL_VERSION),
 //		eglQueryString(e->display, EGL_VENDOR));
 
+	{
+		const char *extensions = eglQueryString(e->display, EGL_EXTENSIONS);
+
+		if (extensions && strstr(extensions, "EGL_KHR_image_base")) {
+			e->create_image = (PFNEGLCREATEIMAGEKHRPROC)
+				eglGetProcAddress("eglCreateImageKHR");
+			e->destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)
+				eglGetProcAddress("eglDestroyImageKHR");
+		}
+		if (e->create_image && e->destroy_image) {
+			e->has_dmabuf_import =
+				strstr(extensions, "EGL_EXT_image_dma_buf_import");
+			e->has_image_pixmap =
+				strstr(extensions, "EGL_KHR_image_pixmap");
+		}
+		if (extensions && strstr(extensions, "EGL_KHR_fence_sync")) {
+			e->create_sync = (PFNEGLCREATESYNCKHRPROC)
+				eglGetProcAddress("eglCreateSyncKHR");
+			e->destroy_sync = (PFNEGLDESTROYSYNCKHRPROC)
+				eglGetProcAddress("eglDestroySyncKHR");
+			e->client_wait_sync = (PFNEGLCLIENTWAITSYNCKHRPROC)
+				eglGetProcAddress("eglClientWaitSyncKHR");
+			if (!e->destroy_sync || !e->client_wait_sync)
+				e->create_sync = NULL;
+		}
+		fprintf(stderr, "MSG: have %sdma-buf import support\n",
+			e->has_dmabuf_import ? "" : "no ");
+
+		mutable_buffer = low_latency && extensions &&
+			strstr(extensions, "EGL_KHR_mutable_render_buffer");
+	}
+
 	ret = eglBindAPI(EGL_OPENGL_ES_API);
 	if (!ret) {
 		fprintf(stderr, "ERR: %s: eglBindAPI failed: 0x%x\n",
@@ -387,20 +1400,41 @@ static int egl_backend_create(egl_backend_t **egl, x11_backend_t *x11)
 		goto cleanup;
 	}
 
-	ret = eglChooseConfig(e->display, cfg_attr, &cfg, 1, &num);
+	if (mutable_buffer &&
+	    (!eglChooseConfig(e->display, mutable_attr, &cfg, 1, &num) || !num))
+		mutable_buffer = false;
+	ret = mutable_buffer ? EGL_TRUE :
+		eglChooseConfig(e->display, cfg_attr, &cfg, 1, &num);
 	if (!ret) {
 		fprintf(stderr, "ERR: %s: eglChooseConfig failed: 0x%x\n",
 			__func__, eglGetError());
 		goto cleanup;
 	}
 
-	e->surface = eglCreateWindowSurface(e->display, cfg, x11->window, NULL);
+	e->config = cfg;
+	e->surface = eglCreateWindowSurface(e->display, cfg, x11->window,
+					    low_latency && !mutable_buffer ?
+					    single_attr : NULL);
+	/* not every platform takes the hint, some refuse the surface */
+	if (e->surface == EGL_NO_SURFACE && low_latency && !mutable_buffer)
+		e->surface = eglCreateWindowSurface(e->display, cfg,
+						    x11->window, NULL);
 	if (e->surface == EGL_NO_SURFACE) {
 		fprintf(stderr, "ERR: %s: eglCreateWindowSurface failed: 0x%x\n",
 			__func__, eglGetError());
 		goto cleanup;
 	}
 
+	for (unsigned i = 0; i < x11->num_clones; i++) {
+		e->clones[i] = eglCreateWindowSurface(e->display, cfg,
+						      x11->clones[i], NULL);
+		if (e->clones[i] == EGL_NO_SURFACE) {
+			fprintf(stderr, "ERR: %s: eglCreateWindowSurface(clone %u) "
+				"failed: 0x%x\n", __func__, i, eglGetError());
+			goto cleanup;
+		}
+	}
+
 	e->context = eglCreateContext(e->display, cfg, EGL_NO_CONTEXT, ctx_attr);
 	if (e->context == EGL_NO_CONTEXT) {
 		fprintf(stderr, "ERR: %s: eglCreateContext failed: 0x%x\n",
@@ -408,6 +1442,12 @@ static int egl_backend_create(egl_backend_t **egl, x11_backend_t *x11)
 		goto cleanup;
 	}
 
+	/* only the main window waits for vsync, the clones just follow it */
+	for (unsigned i = 0; i < x11->num_clones; i++) {
+		eglMakeCurrent(e->display, e->clones[i], e->clones[i], e->context);
+		eglSwapInterval(e->display, 0);
+	}
+
 	ret= eglMakeCurrent(e->display, e->surface, e->surface, e->context);
 	if (!ret) {
 		fprintf(stderr, "ERR: %s: eglMakeCurrent failed: 0x%x\n",
@@ -415,6 +1455,72 @@ static int egl_backend_create(egl_backend_t **egl, x11_backend_t *x11)
 		goto cleanup;
 	}
 
+	if (low_latency)
+		egl_low_latency(e, mutable_buffer);
+
+	*egl = e;
+	return VLC_SUCCESS;
+
+cleanup:
+	egl_backend_destroy(e);
+	return VLC_EGENERIC;
+}
+
+/*
+ * Create a context sharing its objects with the one of another output. It
+ * never draws to a window, so a pbuffer (or no surface at all) is enough.
+ */
+static int egl_backend_create_shared(egl_backend_t **egl,
+				     const egl_backend_t *share)
+{
+	const EGLint pbuf_attr[] = {
+		EGL_WIDTH, 1,
+		EGL_HEIGHT, 1,
+		EGL_NONE
+	};
+	const EGLint ctx_attr[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+	egl_backend_t *e;
+	EGLBoolean ret;
+
+	e = calloc(1, sizeof(*e));
+	if (unlikely(e == NULL)) {
+		fprintf(stderr, "ERR: %s: calloc failed\n", __func__);
+		return VLC_ENOMEM;
+	}
+
+	e->shared  = true;
+	e->display = share->display;
+	e->config  = share->config;
+
+	e->has_dmabuf_import = share->has_dmabuf_import;
+	e->has_image_pixmap  = share->has_image_pixmap;
+	e->create_image      = share->create_image;
+	e->destroy_image     = share->destroy_image;
+	e->create_sync       = share->create_sync;
+	e->destroy_sync      = share->destroy_sync;
+	e->client_wait_sync  = share->client_wait_sync;
+
+	e->context = eglCreateContext(e->display, e->config, share->context,
+				      ctx_attr);
+	if (e->context == EGL_NO_CONTEXT) {
+		fprintf(stderr, "ERR: %s: eglCreateContext failed: 0x%x\n",
+			__func__, eglGetError());
+		goto cleanup;
+	}
+
+	/* falls back to EGL_KHR_surfaceless_context if this fails */
+	e->surface = eglCreatePbufferSurface(e->display, e->config, pbuf_attr);
+
+	ret = eglMakeCurrent(e->display, e->surface, e->surface, e->context);
+	if (!ret) {
+		fprintf(stderr, "ERR: %s: eglMakeCurrent failed: 0x%x\n",
+			__func__, eglGetError());
+		goto cleanup;
+	}
+
 	*egl = e;
 	return VLC_SUCCESS;
 
@@ -425,6 +1531,7 @@ cleanup:
 
 static void shader_delete(gl_shader_t *shader)
 {
+	gl_objects -= !!shader->vertex + !!shader->fragment + !!shader->program;
 	if (shader->vertex) {
 		glDeleteShader(shader->vertex);
 		shader->vertex = 0;
@@ -439,8 +1546,43 @@ static void shader_delete(gl_shader_t *shader)
 	}
 }
 
-static int shader_load_source(const GLchar *src, GLenum type)
+/*
+ * Fill gl->header, prepended to the built-in fragment shaders of this
+ * output: the default precision for colour math, and TC for everything
+ * that addresses texels. Each output keeps its own, picked for its GPU,
+ * since outputs may build their programs on other threads.
+ */
+static void shader_precision_init(opengl_es2_t *gl)
+{
+	GLint range[2], high = 0, medium = 0;
+	const char *coord, *colour;
+
+	glGetShaderPrecisionFormat(GL_FRAGMENT_SHADER, GL_HIGH_FLOAT,
+				   range, &high);
+	glGetShaderPrecisionFormat(GL_FRAGMENT_SHADER, GL_MEDIUM_FLOAT,
+				   range, &medium);
+
+	/* no highp in fragment shaders reports 0 bits */
+	coord = high > medium ? "highp" : "mediump";
+	/* 8 bit colours need at least 10 bits through the conversion */
+	colour = medium < 10 && high > medium ? "highp" : "mediump";
+
+	snprintf(gl->header, sizeof(gl->header),
+		 "precision %s float;\n#define TC %s\n", colour, coord);
+	fprintf(stderr, "MSG: fragment precision highp %d bits, mediump %d "
+		"bits: %s coordinates, %s colours\n", high, medium,
+		coord, colour);
+	if (!strcmp(coord, "mediump") && medium > 0 && medium < 13)
+		fprintf(stderr, "MSG: coordinates may miss lines above %d\n",
+			1 << (medium - 1));
+}
+
+static int shader_load_source(const GLchar *header, const GLchar *defines,
+			      const GLchar *src, GLenum type)
 {
+	const GLchar *srcs[] = {
+		header ? header : "", defines ? defines : "", src
+	};
 	GLint compiled;
 	GLuint s;
 
@@ -450,8 +1592,9 @@ static int shader_load_source(const GLchar *src, GLenum type)
 			__func__);
 		return 0;
 	}
+	gl_objects++;
 
-	glShaderSource(s, 1, &src, NULL);
+	glShaderSource(s, ARRAY_SIZE(srcs), srcs, NULL);
 	glCompileShader(s);
 
 	glGetShaderiv(s, GL_COMPILE_STATUS, &compiled);
@@ -465,13 +1608,117 @@ static int shader_load_source(const GLchar *src, GLenum type)
 			fprintf(stderr, "ERR: %s\n", info);
 		}
 		glDeleteShader(s);
+		gl_objects--;
 		return 0;
 	}
 
 	return s;
 }
 
-static int shader_load(gl_shader_t *shader, enum shader_types type)
+/*
+ * Colour correction through a 3D LUT of lut_size^3 entries, unwrapped into
+ * a 2D texture with the blue slices side by side. Red and green are
+ * filtered by the sampler, blue by mixing two neighbouring slices.
+ */
+#define LUT_FUNCTION \
+	"#ifdef LUT\n" \
+	"uniform sampler2D s_lut;\n" \
+	"uniform TC float lut_size;\n" \
+	"\n" \
+	"vec3 apply_lut(vec3 c) {\n" \
+	"	TC vec3 pos = clamp(c, 0.0, 1.0) * (lut_size - 1.0);\n" \
+	"	TC float slice = floor(pos.b);\n" \
+	"	TC vec2 t = vec2(pos.r + 0.5 + slice * lut_size, pos.g + 0.5) / vec2(lut_size * lut_size, lut_size);\n" \
+	"	vec3 lo = texture2D(s_lut, t).rgb;\n" \
+	"	vec3 hi = texture2D(s_lut, t + vec2(1.0 / lut_size, 0.0)).rgb;\n" \
+	"\n" \
+	"	return mix(lo, hi, pos.b - slice);\n" \
+	"}\n" \
+	"#define LUT_APPLY(c) apply_lut(c)\n" \
+	"#else\n" \
+	"#define LUT_APPLY(c) (c)\n" \
+	"#endif\n"
+
+/*
+ * Temporal denoise: where the colour barely changed since the previous
+ * conversion, blend in up to denoise_strength of it. The history is drawn
+ * top down like the output, pos is the coordinate in the picture.
+ */
+#define DENOISE_FUNCTION \
+	"#ifdef DENOISE\n" \
+	"uniform sampler2D s_hist;\n" \
+	"uniform float denoise_strength;\n" \
+	"\n" \
+	"vec3 apply_denoise(vec3 c, TC vec2 pos) {\n" \
+	"	vec3 prev = texture2D(s_hist, vec2(pos.x, 1.0 - pos.y)).rgb;\n" \
+	"	float w = denoise_strength * (1.0 - smoothstep(0.02, 0.08, distance(c, prev)));\n" \
+	"\n" \
+	"	return mix(c, prev, w);\n" \
+	"}\n" \
+	"#define DENOISE_APPLY(c, pos) apply_denoise(c, pos)\n" \
+	"#else\n" \
+	"#define DENOISE_APPLY(c, pos) (c)\n" \
+	"#endif\n"
+
+/*
+ * HDR10 (PQ) and HLG to SDR. The signal is linearised with SDR white at
+ * 1.0, the 203 nits of BT.2408, moved from BT.2020 to BT.709 primaries, tone
+ * mapped from hdr_peak down to white by luminance, desaturated back into
+ * the gamut and encoded for a gamma 2.4 display. The curves run out of
+ * mediump, hence HP wherever highp exists. yuv_k holds the YUV to RGB
+ * coefficients of the matrix the video uses.
+ */
+#define HDR_FUNCTION \
+	"#ifdef YUV2020\n" \
+	"const vec4 yuv_k = vec4(1.6787, 0.18732, 0.65042, 2.1418);\n" \
+	"#else\n" \
+	"const vec4 yuv_k = vec4(1.5958, 0.39173, 0.81290, 2.017);\n" \
+	"#endif\n" \
+	"#if defined(PQ) || defined(HLG)\n" \
+	"#ifdef GL_FRAGMENT_PRECISION_HIGH\n" \
+	"#define HP highp\n" \
+	"#else\n" \
+	"#define HP mediump\n" \
+	"#endif\n" \
+	"uniform HP float hdr_peak;\n" \
+	"uniform HP float hdr_gamma;\n" \
+	"\n" \
+	"vec3 apply_hdr(HP vec3 c) {\n" \
+	"	HP vec3 e = clamp(c, 0.0, 1.0);\n" \
+	"#ifdef PQ\n" \
+	"	HP vec3 p = pow(e, vec3(1.0 / 78.84375));\n" \
+	"	HP vec3 l = pow(max(p - 0.8359375, 0.0) / (18.8515625 - 18.6875 * p), vec3(1.0 / 0.1593017578125)) * (10000.0 / 203.0);\n" \
+	"#else\n" \
+	"	HP vec3 s = mix(e * e / 3.0, (exp((e - 0.55991073) / 0.17883277) + 0.28466892) / 12.0, step(0.5, e));\n" \
+	"	HP float ys = dot(s, vec3(0.2627, 0.6780, 0.0593));\n" \
+	"	HP vec3 l = s * pow(max(ys, 0.0001), hdr_gamma - 1.0) * (hdr_peak / 203.0);\n" \
+	"#endif\n" \
+	"	HP float w = hdr_peak / 203.0;\n" \
+	"	HP float y, lo;\n" \
+	"\n" \
+	"#ifdef GAMUT2020\n" \
+	"	l = mat3(1.6605, -0.1246, -0.0182, -0.5876, 1.1329, -0.1006, -0.0728, -0.0083, 1.1187) * l;\n" \
+	"#endif\n" \
+	"	y = max(dot(l, vec3(0.2126, 0.7152, 0.0722)), 0.0);\n" \
+	"	l *= (1.0 + y / (w * w)) / (1.0 + y);\n" \
+	"	y *= (1.0 + y / (w * w)) / (1.0 + y);\n" \
+	"	lo = min(min(l.r, l.g), l.b);\n" \
+	"	l = mix(vec3(y), l, clamp(y / max(y - lo, 0.0001), 0.0, 1.0));\n" \
+	"\n" \
+	"	return pow(clamp(l, 0.0, 1.0), vec3(1.0 / 2.4));\n" \
+	"}\n" \
+	"#define HDR_APPLY(c) apply_hdr(c)\n" \
+	"#else\n" \
+	"#define HDR_APPLY(c) (c)\n" \
+	"#endif\n"
+
+/*
+ * custom is the fragment source of SHADER_TYPE_CUSTOM, and extra #defines
+ * selecting a variant of the built-in programs. These get the precision
+ * header of gl, which may be NULL for SHADER_TYPE_CUSTOM.
+ */
+static int shader_load(const opengl_es2_t *gl, gl_shader_t *shader,
+		       enum shader_types type, const GLchar *custom)
 {
 	static const GLchar vertex[] = {
 		"attribute vec4 vPosition;\n"
@@ -483,37 +1730,58 @@ static int shader_load(gl_shader_t *shader, enum shader_types type)
 		"	vTexcoord = aTexcoord;\n"
 		"}"
 	};
+	/*
+	 * SHARPEN adds an unsharp mask on luma, with the detail against the
+	 * four neighbours. It fades out on strong edges, which would ring.
+	 */
 	static const GLchar fragment_copy[] = {
-		"precision mediump float;\n"
-		"varying vec2 vTexcoord;\n"
+		"varying TC vec2 vTexcoord;\n"
 		"uniform sampler2D s_tex;\n"
-		"uniform float line_height;\n"
+		"uniform TC float line_height;\n"
+		"#ifdef SHARPEN\n"
+		"uniform TC vec2 texel_size;\n"
+		"uniform float sharpen_strength;\n"
+		"#endif\n"
 		"\n"
 		"void main() {\n"
-		"	gl_FragColor = vec4(texture2D(s_tex, vTexcoord).rgb, 1.0);\n"
+		"	vec3 c = texture2D(s_tex, vTexcoord).rgb;\n"
+		"#ifdef SHARPEN\n"
+		"	vec3 blur = (texture2D(s_tex, vTexcoord + vec2(texel_size.x, 0.0)).rgb +\n"
+		"		     texture2D(s_tex, vTexcoord - vec2(texel_size.x, 0.0)).rgb +\n"
+		"		     texture2D(s_tex, vTexcoord + vec2(0.0, texel_size.y)).rgb +\n"
+		"		     texture2D(s_tex, vTexcoord - vec2(0.0, texel_size.y)).rgb) * 0.25;\n"
+		"	float detail = dot(c - blur, vec3(0.299, 0.587, 0.114));\n"
+		"\n"
+		"	c += detail * sharpen_strength * (1.0 - smoothstep(0.05, 0.25, abs(detail)));\n"
+		"#endif\n"
+		"	gl_FragColor = vec4(c, 1.0);\n"
 		"}"
 	};
 	static const GLchar fragment_deint[] = {
-		"precision mediump float;\n"
 		"\n"
-		"varying vec2 vTexcoord;\n"
+		"varying TC vec2 vTexcoord;\n"
 		"\n"
 		"uniform sampler2D s_ytex;\n"
 		"uniform sampler2D s_utex;\n"
 		"uniform sampler2D s_vtex;\n"
-		"uniform float line_height;\n"
+		"uniform TC float line_height;\n"
+		"uniform float chroma_scale;\n"
+		"\n"
+		HDR_FUNCTION
+		DENOISE_FUNCTION
+		LUT_FUNCTION
 		"\n"
 		"void main() {\n"
 		"	float y1, y2, u1, u2, v1, v2;\n"
 		"	float r, g, b;\n"
 		"	float y, u, v;\n"
-		"	vec2 tmpcoord;\n"
-		"	vec2 tmpcoord_2;\n"
+		"	TC vec2 tmpcoord;\n"
+		"	TC vec2 tmpcoord_2;\n"
 		"\n"
 		"	tmpcoord.x = vTexcoord.x;\n"
 		"	tmpcoord.y = vTexcoord.y + line_height;\n"
 		"	tmpcoord_2.x = vTexcoord.x;\n"
-		"	tmpcoord_2.y = vTexcoord.y + line_height*2.0;\n"
+		"	tmpcoord_2.y = vTexcoord.y + line_height / chroma_scale;\n"
 		"\n"
 		"	y1 = texture2D(s_ytex, vTexcoord).r;\n"
 		"	y2 = texture2D(s_ytex, tmpcoord).r;\n"
@@ -530,49 +1798,218 @@ static int shader_load(gl_shader_t *shader, enum shader_types type)
 		"	u = u - 0.5;\n"
 		"	v = v - 0.5;\n"
 		"\n"
-		"	r = y + 1.5958 * v;\n"
-		"	g = y - 0.39173 * u - 0.81290 * v;\n"
-		"	b = y + 2.017 * u;\n"
+		"	r = y + yuv_k.x * v;\n"
+		"	g = y - yuv_k.y * u - yuv_k.z * v;\n"
+		"	b = y + yuv_k.w * u;\n"
 		"\n"
-		"	gl_FragColor = vec4(r, g, b, 1.0);\n"
+		"	gl_FragColor = vec4(DENOISE_APPLY(LUT_APPLY(HDR_APPLY(vec3(r, g, b))), vTexcoord), 1.0);\n"
 		"}"
 	};
-	const GLchar *fragment;
-
-	if (type == SHADER_TYPE_DEINT_LINEAR)
-		fragment = fragment_deint;
-	else
-		fragment = fragment_copy;
-
-	shader->vertex = shader_load_source(vertex, GL_VERTEX_SHADER);
-	if (shader->vertex == 0) {
-		fprintf(stderr, "ERR: %s: shader_load_source(vertex) failed\n",
-			__func__);
-		return -1;
-	}
-
-	shader->fragment = shader_load_source(fragment, GL_FRAGMENT_SHADER);
-	if (shader->fragment == 0) {
-		fprintf(stderr, "ERR: %s: shader_load_source(fragment) failed\n",
-			__func__);
-		return -1;
-	}
-	return 0;
-}
-
-static int shader_init(gl_shader_t *shader, enum shader_types type)
-{
-	int linked, ret;
-	GLint err;
-
-	shader->program = glCreateProgram();
-	if (shader->program == 0) {
-		fprintf(stderr, "ERR: %s: glCreateProgram failed %d\n",
-			__func__, glGetError());
-		return -1;
-	}
+	static const GLchar fragment_weave[] = {
+		"\n"
+		"varying TC vec2 vTexcoord;\n"
+		"\n"
+		"uniform sampler2D s_ytex;\n"
+		"uniform sampler2D s_utex;\n"
+		"uniform sampler2D s_vtex;\n"
+		"uniform sampler2D s_yprev;\n"
+		"uniform sampler2D s_uprev;\n"
+		"uniform sampler2D s_vprev;\n"
+		"uniform TC float height;\n"
+		"uniform float chroma_scale;\n"
+		"uniform float use_prev;\n"
+		"\n"
+		HDR_FUNCTION
+		DENOISE_FUNCTION
+		LUT_FUNCTION
+		"\n"
+		"void main() {\n"
+		"	float r, g, b;\n"
+		"	float y, u, v;\n"
+		"	float ybottom, cbottom;\n"
+		"\n"
+		"	/* odd lines are the bottom field, for luma and chroma alike */\n"
+		"	ybottom = use_prev * step(1.0, mod(floor(vTexcoord.y * height), 2.0));\n"
+		"	cbottom = use_prev * step(1.0, mod(floor(vTexcoord.y * height * chroma_scale), 2.0));\n"
+		"\n"
+		"	y = mix(texture2D(s_ytex, vTexcoord).r, texture2D(s_yprev, vTexcoord).r, ybottom);\n"
+		"	u = mix(texture2D(s_utex, vTexcoord).r, texture2D(s_uprev, vTexcoord).r, cbottom);\n"
+		"	v = mix(texture2D(s_vtex, vTexcoord).r, texture2D(s_vprev, vTexcoord).r, cbottom);\n"
+		"\n"
+		"	y = 1.1643 * (y - 0.0625);\n"
+		"	u = u - 0.5;\n"
+		"	v = v - 0.5;\n"
+		"\n"
+		"	r = y + yuv_k.x * v;\n"
+		"	g = y - yuv_k.y * u - yuv_k.z * v;\n"
+		"	b = y + yuv_k.w * u;\n"
+		"\n"
+		"	gl_FragColor = vec4(DENOISE_APPLY(LUT_APPLY(HDR_APPLY(vec3(r, g, b))), vTexcoord), 1.0);\n"
+		"}"
+	};
+	/*
+	 * One output pixel per block of the picture: how much the top field
+	 * combs with the current (r) and the previous (g) bottom field, and
+	 * how much the top field changed since the previous frame (b).
+	 */
+	static const GLchar fragment_metric[] = {
+		"\n"
+		"varying TC vec2 vTexcoord;\n"
+		"\n"
+		"uniform sampler2D s_ytex;\n"
+		"uniform sampler2D s_yprev;\n"
+		"uniform TC float height;\n"
+		"\n"
+		"void main() {\n"
+		"	vec3 m = vec3(0.0);\n"
+		"\n"
+		"	for (int i = 0; i < 4; i++) {\n"
+		"		for (int j = 0; j < 4; j++) {\n"
+		"			TC vec2 pos = vTexcoord + (vec2(float(i), float(j)) - 1.5) / 64.0;\n"
+		"			TC float row = floor(pos.y * height * 0.5) * 2.0;\n"
+		"			TC vec2 t0 = vec2(pos.x, (row + 0.5) / height);\n"
+		"			TC vec2 t1 = vec2(pos.x, (row + 1.5) / height);\n"
+		"			TC vec2 t2 = vec2(pos.x, (row + 2.5) / height);\n"
+		"			float a  = texture2D(s_ytex, t0).r;\n"
+		"			float c  = texture2D(s_ytex, t2).r;\n"
+		"			float bc = texture2D(s_ytex, t1).r;\n"
+		"			float bp = texture2D(s_yprev, t1).r;\n"
+		"			float ap = texture2D(s_yprev, t0).r;\n"
+		"\n"
+		"			m.r += max((bc - a) * (bc - c), 0.0);\n"
+		"			m.g += max((bp - a) * (bp - c), 0.0);\n"
+		"			m.b += abs(a - ap);\n"
+		"		}\n"
+		"	}\n"
+		"\n"
+		"	gl_FragColor = vec4(min(m * vec3(4.0, 4.0, 0.25), 1.0), 1.0);\n"
+		"}"
+	};
+	static const GLchar fragment_grey[] = {
+		"\n"
+		"varying TC vec2 vTexcoord;\n"
+		"\n"
+		"uniform sampler2D s_ytex;\n"
+		"uniform TC float line_height;\n"
+		"\n"
+		HDR_FUNCTION
+		DENOISE_FUNCTION
+		LUT_FUNCTION
+		"\n"
+		"void main() {\n"
+		"	TC vec2 tmpcoord = vec2(vTexcoord.x, vTexcoord.y + line_height);\n"
+		"	float y;\n"
+		"\n"
+		"	y = mix(texture2D(s_ytex, vTexcoord).r, texture2D(s_ytex, tmpcoord).r, 0.5);\n"
+		"	y = 1.1643 * (y - 0.0625);\n"
+		"\n"
+		"	gl_FragColor = vec4(DENOISE_APPLY(LUT_APPLY(HDR_APPLY(vec3(y))), vTexcoord), 1.0);\n"
+		"}"
+	};
+	/* the mean luma of a block of the picture */
+	static const GLchar fragment_analytics[] = {
+		"\n"
+		"varying TC vec2 vTexcoord;\n"
+		"\n"
+		"uniform sampler2D s_ytex;\n"
+		"\n"
+		"void main() {\n"
+		"	float sum = 0.0;\n"
+		"\n"
+		"	for (int i = 0; i < 4; i++)\n"
+		"		for (int j = 0; j < 4; j++)\n"
+		"			sum += texture2D(s_ytex, vTexcoord + (vec2(float(i), float(j)) - 1.5) / 64.0).r;\n"
+		"\n"
+		"	gl_FragColor = vec4(sum / 16.0, 0.0, 0.0, 1.0);\n"
+		"}"
+	};
+	/* the brightest luma of a cell of the picture */
+	static const GLchar fragment_crop[] = {
+		"\n"
+		"varying TC vec2 vTexcoord;\n"
+		"\n"
+		"uniform sampler2D s_ytex;\n"
+		"\n"
+		"void main() {\n"
+		"	float m = 0.0;\n"
+		"\n"
+		"	for (int i = 0; i < 2; i++)\n"
+		"		for (int j = 0; j < 2; j++)\n"
+		"			m = max(m, texture2D(s_ytex, vTexcoord + (vec2(float(i), float(j)) - 0.5) / 256.0).r);\n"
+		"\n"
+		"	gl_FragColor = vec4(m, 0.0, 0.0, 1.0);\n"
+		"}"
+	};
+	/* glyphs are white, the cell around them darkens the video */
+	static const GLchar fragment_overlay[] = {
+		"varying TC vec2 vTexcoord;\n"
+		"uniform sampler2D s_tex;\n"
+		"\n"
+		"void main() {\n"
+		"	float a = texture2D(s_tex, vTexcoord).r;\n"
+		"	gl_FragColor = vec4(a, a, a, max(a, 0.5));\n"
+		"}"
+	};
+	const GLchar *fragment;
+
+	if (type == SHADER_TYPE_DEINT_LINEAR)
+		fragment = fragment_deint;
+	else if (type == SHADER_TYPE_IVTC_WEAVE)
+		fragment = fragment_weave;
+	else if (type == SHADER_TYPE_IVTC_METRIC)
+		fragment = fragment_metric;
+	else if (type == SHADER_TYPE_CUSTOM)
+		fragment = custom;
+	else if (type == SHADER_TYPE_OVERLAY)
+		fragment = fragment_overlay;
+	else if (type == SHADER_TYPE_GREY)
+		fragment = fragment_grey;
+	else if (type == SHADER_TYPE_ANALYTICS)
+		fragment = fragment_analytics;
+	else if (type == SHADER_TYPE_CROP)
+		fragment = fragment_crop;
+	else
+		fragment = fragment_copy;
+
+	shader->vertex = shader_load_source(NULL, NULL, vertex,
+					    GL_VERTEX_SHADER);
+	if (shader->vertex == 0) {
+		fprintf(stderr, "ERR: %s: shader_load_source(vertex) failed\n",
+			__func__);
+		return -1;
+	}
+
+	/* custom passes state their own precision */
+	if (type == SHADER_TYPE_CUSTOM)
+		shader->fragment = shader_load_source(NULL, NULL, fragment,
+						      GL_FRAGMENT_SHADER);
+	else
+		shader->fragment = shader_load_source(gl->header, custom,
+						      fragment,
+						      GL_FRAGMENT_SHADER);
+	if (shader->fragment == 0) {
+		fprintf(stderr, "ERR: %s: shader_load_source(fragment) failed\n",
+			__func__);
+		return -1;
+	}
+	return 0;
+}
+
+static int shader_init(const opengl_es2_t *gl, gl_shader_t *shader,
+		       enum shader_types type, const GLchar *custom)
+{
+	int linked, ret;
+	GLint err;
+
+	shader->program = glCreateProgram();
+	if (shader->program == 0) {
+		fprintf(stderr, "ERR: %s: glCreateProgram failed %d\n",
+			__func__, glGetError());
+		return -1;
+	}
+	gl_objects++;
 
-	ret = shader_load(shader, type);
+	ret = shader_load(gl, shader, type, custom);
 	if (ret < 0) {
 		fprintf(stderr, "ERR: %s: shader_load failed\n", __func__);
 		goto failure;
@@ -607,7 +2044,7 @@ static int shader_init(gl_shader_t *shader, enum shader_types type)
 
 			fprintf(stderr, "ERR: %s: %s\n", __func__, info);
 		}
-		glDeleteProgram(shader->program);
+		goto failure;
 	}
 
 	glUseProgram(shader->program);
@@ -629,6 +2066,7 @@ static GLuint texture_create(GLenum type)
 	GLuint tex = 0;
 
 	glGenTextures(1, &tex);
+	gl_objects++;
 
 	glBindTexture(GL_TEXTURE_2D, tex);
 
@@ -640,239 +2078,3463 @@ static GLuint texture_create(GLenum type)
 	return tex;
 }
 
+/* glDeleteTextures() and glDeleteFramebuffers(), keeping gl_objects */
+static void textures_delete(GLsizei n, const GLuint *tex)
+{
+	for (GLsizei i = 0; i < n; i++)
+		gl_objects -= !!tex[i];
+	glDeleteTextures(n, tex);
+}
+
+static void framebuffers_delete(GLsizei n, const GLuint *framebuffer)
+{
+	for (GLsizei i = 0; i < n; i++)
+		gl_objects -= !!framebuffer[i];
+	glDeleteFramebuffers(n, framebuffer);
+}
+
+/* an rgb texture of the given size and a framebuffer rendering into it */
+static void framebuffer_create(GLuint *framebuffer, GLuint *tex,
+			       unsigned width, unsigned height)
+{
+	glGenFramebuffers(1, framebuffer);
+	gl_objects++;
+
+	*tex = texture_create(GL_LINEAR);
+
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height,
+		     0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, *framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_2D, *tex, 0);
+}
+
+/*
+ * Bind the framebuffer and tell the driver its contents are not needed
+ * any more, so a tiler neither writes them back nor loads them again.
+ */
+static void framebuffer_discard(const opengl_es2_t *gl, GLuint framebuffer)
+{
+	static const GLenum attachment[] = { GL_COLOR_ATTACHMENT0 };
+	static const GLenum window[] = { GL_COLOR_EXT };
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	if (gl->discard_framebuffer)
+		gl->discard_framebuffer(GL_FRAMEBUFFER, 1,
+					framebuffer ? attachment : window);
+}
+
+/* the planes the conversion samples, the others are not uploaded */
+static int sampled_planes(const vout_display_sys_t *vout, const picture_t *p)
+{
+	return vout->luma_only ? 1 : p->i_planes;
+}
+
 /*
  * TODO: This function shall be used if we do not have GL_UNPACK_ROW_LENGTH
  * support. Therefor we need to strip the data we get before we load it into
  * the textures.
  */
-static void update_textures_complex(vout_display_sys_t *vout, picture_t *p)
+static void update_textures_complex(vout_display_sys_t *vout, picture_t *p)
+{
+	const video_format_t *const f = &vout->vd->fmt;
+	const vlc_chroma_description_t *c;
+	opengl_es2_t *gl = vout->gl;
+	GLbyte *buf, *dst, *src;
+
+	fprintf(stderr, "> %s()\n", __func__);
+
+	c = vlc_fourcc_GetChromaDescription(f->i_chroma);
+
+	for (int i = 0; i < sampled_planes(vout, p); i++) {
+		unsigned rows = f->i_visible_height * c->p[i].h.num / c->p[i].h.den;
+		unsigned line = f->i_visible_width * c->p[i].w.num / c->p[i].w.den;
+
+		dst = buf = alloca(line * rows);
+		src = p->p[i].p_pixels;
+
+		for (unsigned r = 0; r < rows; r++) {
+			memcpy(dst, src, line);
+			src += p->p[i].i_pitch / p->p[i].i_pixel_pitch;
+			dst += line;
+		}
+
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, gl->tex[i].id);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, line, rows,
+			     0, GL_LUMINANCE, GL_UNSIGNED_BYTE, buf);
+		glUniform1i(gl->tex[i].loc, i);
+	}
+	fprintf(stderr, "< %s()\n", __func__);
+}
+
+static void update_textures_simple(vout_display_sys_t *vout, picture_t *p)
+{
+	opengl_es2_t *gl = vout->gl;
+
+	for (int i = 0; i < sampled_planes(vout, p); i++) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, gl->tex[i].id);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, p->p[i].i_pitch / p->p[i].i_pixel_pitch);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, p->p[i].i_visible_pitch, p->p[i].i_visible_lines,
+		             0, GL_LUMINANCE, GL_UNSIGNED_BYTE, p->p[i].p_pixels);
+		glUniform1i(gl->tex[i].loc, i);
+	}
+	/* reset row packing */
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+#ifdef HAVE_LINUX_UDMABUF_H
+/*
+ * Bracket the accesses of the decoder through the mapping: it may write and
+ * read references from the handing out of the picture to its display.
+ */
+static void dmabuf_cpu_access(picture_sys_t *buf, bool start)
+{
+	struct dma_buf_sync sync = {
+		.flags = (start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END) |
+			 DMA_BUF_SYNC_RW,
+	};
+
+	if (buf->cpu_access == start)
+		return;
+	if (ioctl(buf->dmabuf, DMA_BUF_IOCTL_SYNC, &sync) < 0)
+		fprintf(stderr, "ERR: %s: DMA_BUF_IOCTL_SYNC failed: %s\n",
+			__func__, strerror(errno));
+	buf->cpu_access = start;
+}
+
+static bool dmabuf_import(vout_display_sys_t *vout, picture_t *p)
+{
+	egl_backend_t *egl = vout->egl;
+	picture_sys_t *buf = p->p_sys;
+
+	for (int i = 0; i < p->i_planes; i++) {
+		if (buf->offset[i] > INT32_MAX) {
+			fprintf(stderr, "ERR: %s: plane %d at %zu is out of "
+				"reach\n", __func__, i, buf->offset[i]);
+			return false;
+		}
+	}
+	for (int i = 0; i < p->i_planes; i++) {
+		const EGLint attr[] = {
+			EGL_WIDTH, p->p[i].i_visible_pitch,
+			EGL_HEIGHT, p->p[i].i_visible_lines,
+			EGL_LINUX_DRM_FOURCC_EXT, VLC_FOURCC('R', '8', ' ', ' '),
+			EGL_DMA_BUF_PLANE0_FD_EXT, buf->dmabuf,
+			EGL_DMA_BUF_PLANE0_OFFSET_EXT, buf->offset[i],
+			EGL_DMA_BUF_PLANE0_PITCH_EXT, p->p[i].i_pitch,
+			EGL_NONE
+		};
+
+		buf->image[i] = egl->create_image(egl->display, EGL_NO_CONTEXT,
+						  EGL_LINUX_DMA_BUF_EXT, NULL, attr);
+		if (buf->image[i] == EGL_NO_IMAGE_KHR) {
+			fprintf(stderr, "ERR: %s: eglCreateImageKHR failed: 0x%x\n",
+				__func__, eglGetError());
+			return false;
+		}
+
+		buf->tex[i] = texture_create(GL_NEAREST);
+		vout->gl->image_target_texture(GL_TEXTURE_2D, buf->image[i]);
+	}
+	return true;
+}
+
+static void dmabuf_release_imports(vout_display_sys_t *vout)
+{
+	egl_backend_t *egl = vout->egl;
+
+	for (unsigned n = 0; n < vout->num_dmabufs; n++) {
+		picture_sys_t *buf = vout->dmabufs[n];
+
+		for (unsigned i = 0; i < PICTURE_PLANE_MAX; i++) {
+			if (buf->tex[i])
+				textures_delete(1, &buf->tex[i]);
+			if (buf->image[i] != EGL_NO_IMAGE_KHR)
+				egl->destroy_image(egl->display, buf->image[i]);
+			buf->tex[i] = 0;
+			buf->image[i] = EGL_NO_IMAGE_KHR;
+		}
+		/* uploaded from the mapping from now on, the cpu keeps it */
+		dmabuf_cpu_access(buf, true);
+		buf->owner = NULL;
+	}
+}
+
+/* sample the planes where the decoder left them, nothing to upload */
+static bool update_textures_dmabuf(vout_display_sys_t *vout, picture_t *p)
+{
+	picture_sys_t *buf = p->p_sys;
+
+	if (!buf->tex[0] && !dmabuf_import(vout, p)) {
+		fprintf(stderr, "ERR: %s: import failed, uploading\n", __func__);
+		dmabuf_release_imports(vout);
+		vout->num_dmabufs = 0;
+		return false;
+	}
+
+	/* flush what the decoder wrote through the cpu mapping */
+	dmabuf_cpu_access(buf, false);
+
+	for (int i = 0; i < sampled_planes(vout, p); i++) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, buf->tex[i]);
+		glUniform1i(vout->gl->tex[i].loc, i);
+	}
+	return true;
+}
+#endif
+
+/*
+ * Video wall: the textures keep the size of the planes, but only the tile
+ * and a margin for the filters is updated. Without GL_UNPACK_ROW_LENGTH
+ * whole rows are copied, like update_textures_complex() does.
+ */
+static void update_textures_wall(vout_display_sys_t *vout, picture_t *p)
+{
+	opengl_es2_t *gl = vout->gl;
+	wall_t *wall = vout->wall;
+	const rectangle_t *crop = &gl->crop;
+	const plane_t *luma = &p->p[0];
+
+	for (int i = 0; i < sampled_planes(vout, p); i++) {
+		const plane_t *pl = &p->p[i];
+		const unsigned w = pl->i_visible_pitch / pl->i_pixel_pitch;
+		const unsigned h = pl->i_visible_lines;
+		const unsigned lw = luma->i_visible_pitch / luma->i_pixel_pitch;
+		const unsigned lh = luma->i_visible_lines;
+		unsigned x0 = crop->x * w / lw, x1 = (crop->x + crop->width) * w / lw;
+		unsigned y0 = crop->y * h / lh, y1 = (crop->y + crop->height) * h / lh;
+		const uint8_t *src;
+
+		x0 = x0 > WALL_MARGIN ? x0 - WALL_MARGIN : 0;
+		y0 = y0 > WALL_MARGIN ? y0 - WALL_MARGIN : 0;
+		x1 = MIN(x1 + WALL_MARGIN, w);
+		y1 = MIN(y1 + WALL_MARGIN, h);
+
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, gl->tex[i].id);
+		if (wall->width[i] != w || wall->height[i] != h) {
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, w, h,
+				     0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
+			wall->width[i]  = w;
+			wall->height[i] = h;
+		}
+
+		if (gl->has_unpack_row) {
+			src = pl->p_pixels + y0 * pl->i_pitch +
+			      x0 * pl->i_pixel_pitch;
+			glPixelStorei(GL_UNPACK_ROW_LENGTH,
+				      pl->i_pitch / pl->i_pixel_pitch);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, x1 - x0,
+					y1 - y0, GL_LUMINANCE,
+					GL_UNSIGNED_BYTE, src);
+		} else {
+			const size_t size = (size_t)w * (y1 - y0);
+
+			if (size > wall->scratch_size) {
+				uint8_t *buf = realloc(wall->scratch, size);
+
+				if (!buf) {
+					fprintf(stderr, "ERR: %s: no memory for "
+						"plane %u\n", __func__, i);
+					continue;
+				}
+				wall->scratch = buf;
+				wall->scratch_size = size;
+			}
+			src = pl->p_pixels + y0 * pl->i_pitch;
+			for (unsigned r = 0; r < y1 - y0; r++)
+				memcpy(wall->scratch + r * w,
+				       src + r * pl->i_pitch, w);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y0, w, y1 - y0,
+					GL_LUMINANCE, GL_UNSIGNED_BYTE,
+					wall->scratch);
+		}
+		glUniform1i(gl->tex[i].loc, i);
+	}
+	/* reset row packing */
+	if (gl->has_unpack_row)
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+static void update_textures(vout_display_sys_t *vout, picture_t *p)
+{
+#ifdef HAVE_LINUX_UDMABUF_H
+	if (p->p_sys && p->p_sys->owner == vout && vout->num_dmabufs &&
+	    update_textures_dmabuf(vout, p))
+		return;
+#endif
+	/* inverse telecine compares whole pictures */
+	if (vout->wall && !vout->ivtc)
+		update_textures_wall(vout, p);
+	else if (vout->gl->has_unpack_row)
+		update_textures_simple(vout, p);
+	else
+		update_textures_complex(vout, p);
+}
+
+/* the crop in texture coordinates from the top left: s0, t0, s1, t1 */
+static void crop_texcoords(const vout_display_sys_t *vout, GLfloat tc[4])
+{
+	const video_format_t *f = &vout->vd->fmt;
+	const rectangle_t *crop = &vout->gl->crop;
+
+	tc[0] = (GLfloat)crop->x / f->i_width;
+	tc[1] = (GLfloat)crop->y / f->i_height;
+	tc[2] = (GLfloat)(crop->x + crop->width) / f->i_width;
+	tc[3] = (GLfloat)(crop->y + crop->height) / f->i_height;
+}
+
+static void do_deinterlace_and_color_conversion(vout_display_sys_t *vout, picture_t *p)
+{
+	GLfloat tc[4];
+	crop_texcoords(vout, tc);
+	/* black bars outside the crop are not converted at all */
+	const GLfloat vVertices[] = {
+		-1.0f, -1.0f, tc[0], tc[3],
+		 1.0f, -1.0f, tc[2], tc[3],
+		 1.0f,  1.0f, tc[2], tc[1],
+		-1.0f,  1.0f, tc[0], tc[1],
+	};
+	const GLushort indices[] = {
+		0, 1, 2, 0, 2, 3
+	};
+	const GLuint height = p->format.i_height;
+	opengl_es2_t *gl = vout->gl;
+	const rectangle_t *crop = &gl->crop;
+	const gl_shader_t *shader = vout->luma_only ? &gl->grey : &gl->deint;
+	GLint line_height_loc;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, gl->framebuffer);
+	/* the upload sets the samplers of the three plane program */
+	glUseProgram(gl->deint.program);
+	update_textures(vout, p);
+	glUseProgram(shader->program);
+
+	glViewport(crop->x, height - crop->y - crop->height,
+		   crop->width, crop->height);
+
+	glVertexAttribPointer(shader->position_loc, 2,
+			      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      vVertices);
+	glVertexAttribPointer(shader->texcoord_loc, 2,
+			      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      &vVertices[2]);
+
+	glEnableVertexAttribArray(shader->position_loc);
+	glEnableVertexAttribArray(shader->texcoord_loc);
+
+	line_height_loc = glGetUniformLocation(shader->program, "line_height");
+	glUniform1f(line_height_loc, 1.0/height);
+
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+}
+
+static void draw_quad(const gl_shader_t *shader, const GLfloat *vertices)
+{
+	const GLushort indices[] = {
+		0, 1, 2, 0, 2, 3
+	};
+
+	glVertexAttribPointer(shader->position_loc, 2,
+			      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      vertices);
+	glVertexAttribPointer(shader->texcoord_loc, 2,
+			      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      &vertices[2]);
+
+	glEnableVertexAttribArray(shader->position_loc);
+	glEnableVertexAttribArray(shader->texcoord_loc);
+
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+}
+
+#define LUT_UNIT     7  /* after the planes, the scaler and IVTC */
+#define LUT_MAX_SIZE 65
+
+/*
+ * Read a .cube 3D LUT, in the 0..1 domain, into the unwrapped layout
+ * LUT_FUNCTION samples: blue slices of size x size side by side.
+ */
+static GLubyte *lut_load(const char *path, unsigned *p_size)
+{
+	GLubyte *data = NULL;
+	unsigned size = 0, n = 0;
+	GLint max_size = 0;
+	char line[256];
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "ERR: %s: can not open %s\n", __func__, path);
+		return NULL;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		unsigned r, g, b;
+		float rgb[3];
+
+		if (sscanf(line, "LUT_3D_SIZE %u", &size) == 1) {
+			if (data || size < 2 || size > LUT_MAX_SIZE)
+				goto error;
+			data = malloc(size * size * size * 3);
+			if (!data)
+				goto error;
+			continue;
+		}
+		/* TITLE, DOMAIN_MIN, comments and empty lines */
+		if (sscanf(line, "%f %f %f", &rgb[0], &rgb[1], &rgb[2]) != 3)
+			continue;
+		if (!data || n >= size * size * size)
+			goto error;
+
+		/* red changes fastest, then green, then blue */
+		r = n % size;
+		g = n / size % size;
+		b = n / (size * size);
+		for (int i = 0; i < 3; i++)
+			data[((g * size + b) * size + r) * 3 + i] =
+				lrintf(VLC_CLIP(rgb[i], 0.f, 1.f) * 255.f);
+		n++;
+	}
+	if (!data || n != size * size * size)
+		goto error;
+	fclose(f);
+
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	if (size * size > (unsigned)max_size) {
+		fprintf(stderr, "ERR: %s: %s needs %u texels, the GPU has %d\n",
+			__func__, path, size * size, max_size);
+		free(data);
+		return NULL;
+	}
+
+	fprintf(stderr, "MSG: %s: %s, %u^3 entries\n", __func__, path, size);
+	*p_size = size;
+	return data;
+
+error:
+	fprintf(stderr, "ERR: %s: %s is no valid 3D LUT\n", __func__, path);
+	free(data);
+	fclose(f);
+	return NULL;
+}
+
+static void lut_uniforms(const opengl_es2_t *gl, GLuint program)
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "s_lut"), LUT_UNIT);
+	glUniform1f(glGetUniformLocation(program, "lut_size"), gl->lut_size);
+}
+
+static void lut_upload(opengl_es2_t *gl, const GLubyte *data, unsigned size)
+{
+	glActiveTexture(GL_TEXTURE0 + LUT_UNIT);
+	gl->lut_tex = texture_create(GL_LINEAR);
+	gl->lut_size = size;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, size * size, size,
+		     0, GL_RGB, GL_UNSIGNED_BYTE, data);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glActiveTexture(GL_TEXTURE0);
+
+	lut_uniforms(gl, gl->deint.program);
+	lut_uniforms(gl, gl->grey.program);
+}
+
+#define HIST_UNIT 3 /* free during the conversion, the scaler rebinds it */
+
+static void denoise_uniforms(const opengl_es2_t *gl, GLuint program)
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "s_hist"), HIST_UNIT);
+	glUniform1f(glGetUniformLocation(program, "denoise_strength"),
+		    gl->denoise);
+}
+
+static void denoise_setup(opengl_es2_t *gl, float strength)
+{
+	gl->denoise = strength;
+	denoise_uniforms(gl, gl->deint.program);
+	denoise_uniforms(gl, gl->grey.program);
+	fprintf(stderr, "MSG: temporal denoise, strength %.2f\n", strength);
+}
+
+static void hdr_uniforms(const opengl_es2_t *gl, GLuint program)
+{
+	glUseProgram(program);
+	glUniform1f(glGetUniformLocation(program, "hdr_peak"), gl->hdr_peak);
+	/* the HLG system gamma of BT.2100 for that peak */
+	glUniform1f(glGetUniformLocation(program, "hdr_gamma"),
+		    1.2 + 0.42 * log10(gl->hdr_peak / 1000.0));
+}
+
+static void hdr_setup(opengl_es2_t *gl, float peak)
+{
+	GLint range[2], high = 0;
+
+	glGetShaderPrecisionFormat(GL_FRAGMENT_SHADER, GL_HIGH_FLOAT,
+				   range, &high);
+	/* the PQ curve needs more than the 10 bits mediump may have */
+	if (!high)
+		fprintf(stderr, "ERR: %s: no highp in fragment shaders, "
+			"expect banding\n", __func__);
+	gl->hdr_peak = peak;
+	hdr_uniforms(gl, gl->deint.program);
+	hdr_uniforms(gl, gl->grey.program);
+	fprintf(stderr, "MSG: HDR to SDR, peak %.0f nits\n", peak);
+}
+
+enum hdr_transfer {
+	HDR_NONE,
+	HDR_PQ,
+	HDR_HLG,
+};
+
+/* the transfer function to undo, and the peak of the content in nits */
+static enum hdr_transfer hdr_detect(vout_display_t *vd, float *peak)
+{
+	enum hdr_transfer transfer = HDR_NONE;
+	char *mode = var_InheritString(vd, "gles2-hdr");
+
+	*peak = var_InheritFloat(vd, "gles2-hdr-peak");
+#if LIBVLC_VERSION_MAJOR >= 3
+	/* transfer and metadata of the video appeared in VLC 3 */
+	if (vd->source.transfer == TRANSFER_FUNC_SMPTE_ST2084)
+		transfer = HDR_PQ;
+	else if (vd->source.transfer == TRANSFER_FUNC_HLG)
+		transfer = HDR_HLG;
+
+	if (vd->source.lighting.MaxCLL)
+		*peak = vd->source.lighting.MaxCLL;
+	else if (vd->source.mastering.max_luminance)
+		*peak = vd->source.mastering.max_luminance / 10000.f;
+#endif
+	if (mode && !strcmp(mode, "pq"))
+		transfer = HDR_PQ;
+	else if (mode && !strcmp(mode, "hlg"))
+		transfer = HDR_HLG;
+	else if (mode && !strcmp(mode, "off"))
+		transfer = HDR_NONE;
+	free(mode);
+
+	/* below SDR white there is nothing to map */
+	*peak = VLC_CLIP(*peak, 203.f, 10000.f);
+	return transfer;
+}
+
+/*
+ * Whether the video uses the BT.2020 YUV matrix and primaries. Before VLC 3
+ * nothing tells, HDR10 and HLG streams are BT.2020 in practice.
+ */
+static void bt2020_detect(vout_display_t *vd, enum hdr_transfer hdr,
+			  bool *matrix, bool *primaries)
+{
+	*matrix = *primaries = hdr != HDR_NONE;
+#if LIBVLC_VERSION_MAJOR >= 3
+	if (vd->source.space != COLOR_SPACE_UNDEF)
+		*matrix = vd->source.space == COLOR_SPACE_BT2020;
+	if (vd->source.primaries != COLOR_PRIMARIES_UNDEF)
+		*primaries = vd->source.primaries == COLOR_PRIMARIES_BT2020;
+#else
+	VLC_UNUSED(vd);
+#endif
+}
+
+/* the new picture goes where the oldest one was, the last one is history */
+static void denoise_swap(opengl_es2_t *gl)
+{
+	GLuint tmp;
+
+	tmp = gl->framebuffer;
+	gl->framebuffer = gl->hist_framebuffer;
+	gl->hist_framebuffer = tmp;
+
+	tmp = gl->rgb_tex.id;
+	gl->rgb_tex.id = gl->hist_tex;
+	gl->hist_tex = tmp;
+}
+
+static int ivtc_create(vout_display_sys_t *sys)
+{
+	static const char *const samplers[] = {
+		"s_ytex", "s_utex", "s_vtex", NULL,
+		"s_yprev", "s_uprev", "s_vprev",
+	};
+	opengl_es2_t *gl = sys->gl;
+
+	sys->ivtc = calloc(1, sizeof(*sys->ivtc));
+	if (!sys->ivtc)
+		return VLC_ENOMEM;
+
+	if (shader_init(gl, &gl->weave, SHADER_TYPE_IVTC_WEAVE, gl->defines) < 0 ||
+	    shader_init(gl, &gl->metric, SHADER_TYPE_IVTC_METRIC, NULL) < 0) {
+		fprintf(stderr, "ERR: %s: shader_init(IVTC)\n", __func__);
+		free(sys->ivtc);
+		sys->ivtc = NULL;
+		return VLC_EGENERIC;
+	}
+
+	/* the previous planes sit on units 4-6, 3 belongs to the scaler */
+	for (unsigned i = 0; i < ARRAY_SIZE(samplers); i++) {
+		if (!samplers[i])
+			continue;
+		glUseProgram(gl->weave.program);
+		glUniform1i(glGetUniformLocation(gl->weave.program, samplers[i]), i);
+		glUseProgram(gl->metric.program);
+		glUniform1i(glGetUniformLocation(gl->metric.program, samplers[i]), i);
+	}
+
+	if (gl->lut_tex)
+		lut_uniforms(gl, gl->weave.program);
+	if (gl->denoise > 0.f)
+		denoise_uniforms(gl, gl->weave.program);
+	if (gl->hdr_peak > 0.f)
+		hdr_uniforms(gl, gl->weave.program);
+
+	for (unsigned i = 0; i < 3; i++)
+		gl->prev_tex[i] = texture_create(GL_NEAREST);
+
+	framebuffer_create(&gl->metric_framebuffer, &gl->metric_tex,
+			   IVTC_GRID, IVTC_GRID);
+	return VLC_SUCCESS;
+}
+
+/*
+ * Decide whether the current frame repeats the previous film frame. The
+ * frame with the smallest top field difference of each cycle is the
+ * repeated one; once it stayed at the same position for two cycles its
+ * successors at that position are dropped.
+ */
+static bool ivtc_is_repeat(ivtc_t *ivtc, float dup)
+{
+	const unsigned pos = ivtc->frame % IVTC_CYCLE;
+	float sum = 0.f;
+	int min = 0;
+
+	ivtc->dup[pos] = dup;
+	if (++ivtc->frame < IVTC_CYCLE)
+		return false;
+
+	for (int i = 0; i < IVTC_CYCLE; i++) {
+		sum += ivtc->dup[i];
+		if (ivtc->dup[i] < ivtc->dup[min])
+			min = i;
+	}
+
+	if (pos == IVTC_CYCLE - 1) {
+		/* the repeat has to stand out clearly from the other frames */
+		bool film = ivtc->dup[min] * 4 * (IVTC_CYCLE - 1) <
+			    sum - ivtc->dup[min];
+
+		if (film && min == ivtc->phase) {
+			if (++ivtc->locked == 2)
+				fprintf(stderr, "MSG: ivtc: 3:2 cadence locked\n");
+		} else {
+			if (ivtc->locked >= 2)
+				fprintf(stderr, "MSG: ivtc: 3:2 cadence lost after "
+					"dropping %u frames\n", ivtc->dropped);
+			ivtc->locked = 0;
+			ivtc->dropped = 0;
+		}
+		ivtc->phase = min;
+	}
+
+	return ivtc->locked >= 2 && (int)pos == ivtc->phase;
+}
+
+/*
+ * Inverse telecine instead of the linear deinterlacer. The metrics of the
+ * current and previous planes are reduced to a IVTC_GRID x IVTC_GRID block
+ * and read back, then the frame is either dropped, rebuilt from matching
+ * fields, or blended as usual if it is really interlaced video.
+ *
+ * The readback is synchronous: every frame the display thread waits until
+ * the GPU finished the upload and the metric pass, unlike the analytics
+ * which read one frame late. Deciding a frame late would need a third set
+ * of planes and show every picture one frame after its date.
+ */
+static bool do_inverse_telecine(vout_display_sys_t *vout, picture_t *p)
+{
+	const GLfloat vVertices[] = {
+		-1.0f, -1.0f, 0.0f, 1.0f,
+		 1.0f, -1.0f, 1.0f, 1.0f,
+		 1.0f,  1.0f, 1.0f, 0.0f,
+		-1.0f,  1.0f, 0.0f, 0.0f,
+	};
+	const GLuint height = p->format.i_height;
+	const GLuint width = p->format.i_width;
+	opengl_es2_t *gl = vout->gl;
+	ivtc_t *ivtc = vout->ivtc;
+	GLubyte metrics[IVTC_GRID * IVTC_GRID * 4];
+	unsigned comb_cur = 0, comb_prev = 0, dup = 0;
+	bool show = true;
+
+	glUseProgram(gl->deint.program);
+	update_textures(vout, p);
+	for (unsigned i = 0; i < 3; i++) {
+		glActiveTexture(GL_TEXTURE4 + i);
+		glBindTexture(GL_TEXTURE_2D, gl->prev_tex[i]);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, gl->metric_framebuffer);
+	glViewport(0, 0, IVTC_GRID, IVTC_GRID);
+	glUseProgram(gl->metric.program);
+	glUniform1f(glGetUniformLocation(gl->metric.program, "height"), height);
+	draw_quad(&gl->metric, vVertices);
+
+	glReadPixels(0, 0, IVTC_GRID, IVTC_GRID, GL_RGBA, GL_UNSIGNED_BYTE,
+		     metrics);
+	for (unsigned i = 0; i < sizeof(metrics); i += 4) {
+		comb_cur  += metrics[i];
+		comb_prev += metrics[i + 1];
+		dup       += metrics[i + 2];
+	}
+
+	if (ivtc_is_repeat(ivtc, dup)) {
+		ivtc->dropped++;
+		show = false;
+		goto out;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, gl->framebuffer);
+	glViewport(0, 0, width, height);
+
+	/* both weaves comb: this is no film, blend like before */
+	if (comb_cur > IVTC_GRID * IVTC_GRID * 8 &&
+	    comb_prev > IVTC_GRID * IVTC_GRID * 8) {
+		glUseProgram(gl->deint.program);
+		glUniform1f(glGetUniformLocation(gl->deint.program, "line_height"),
+			    1.0 / height);
+		draw_quad(&gl->deint, vVertices);
+		goto out;
+	}
+
+	glUseProgram(gl->weave.program);
+	glUniform1f(glGetUniformLocation(gl->weave.program, "height"), height);
+	glUniform1f(glGetUniformLocation(gl->weave.program, "use_prev"),
+		    comb_prev * 3 < comb_cur * 2 ? 1.0 : 0.0);
+	draw_quad(&gl->weave, vVertices);
+
+out:
+	/* the next upload goes to the oldest planes */
+	for (unsigned i = 0; i < 3; i++) {
+		GLuint tmp = gl->tex[i].id;
+		gl->tex[i].id = gl->prev_tex[i];
+		gl->prev_tex[i] = tmp;
+	}
+	return show;
+}
+
+static const char *const analytics_vars[] = {
+	"gles2-luma", "gles2-motion", "gles2-black", "gles2-frozen",
+};
+
+static int analytics_create(vout_display_sys_t *sys)
+{
+	analytics_t *a;
+
+	a = calloc(1, sizeof(*a));
+	if (!a)
+		return VLC_ENOMEM;
+
+	if (shader_init(sys->gl, &a->shader, SHADER_TYPE_ANALYTICS, NULL) < 0) {
+		fprintf(stderr, "ERR: %s: shader_init(ANALYTICS)\n", __func__);
+		free(a);
+		return VLC_EGENERIC;
+	}
+	glUniform1i(glGetUniformLocation(a->shader.program, "s_ytex"), Y_PLANE);
+
+	for (unsigned i = 0; i < ANALYTICS_DELAY; i++)
+		framebuffer_create(&a->framebuffer[i], &a->tex[i],
+				   ANALYTICS_GRID, ANALYTICS_GRID);
+
+	var_Create(sys->vd, "gles2-luma", VLC_VAR_FLOAT);
+	var_Create(sys->vd, "gles2-motion", VLC_VAR_FLOAT);
+	var_Create(sys->vd, "gles2-black", VLC_VAR_BOOL);
+	var_Create(sys->vd, "gles2-frozen", VLC_VAR_BOOL);
+
+	sys->analytics = a;
+	return VLC_SUCCESS;
+}
+
+static void analytics_destroy(vout_display_sys_t *sys)
+{
+	analytics_t *a = sys->analytics;
+
+	if (!a)
+		return;
+
+	for (unsigned i = 0; i < ARRAY_SIZE(analytics_vars); i++)
+		var_Destroy(sys->vd, analytics_vars[i]);
+
+	shader_delete(&a->shader);
+	textures_delete(ANALYTICS_DELAY, a->tex);
+	framebuffers_delete(ANALYTICS_DELAY, a->framebuffer);
+	free(a);
+	sys->analytics = NULL;
+}
+
+/* forget everything measured, e.g. the warm-up picture */
+static void analytics_reset(analytics_t *a)
+{
+	a->frame = 0;
+	memset(a->pending, 0, sizeof(a->pending));
+	a->has_prev = false;
+	a->still = 0;
+	a->black = false;
+	a->frozen = false;
+}
+
+static void analytics_update(vout_display_sys_t *sys, const GLubyte *rgba)
+{
+	analytics_t *a = sys->analytics;
+	unsigned sum = 0, diff = 0, max = 0;
+	bool black, frozen;
+
+	for (unsigned i = 0; i < ANALYTICS_GRID * ANALYTICS_GRID; i++) {
+		const GLubyte y = rgba[i * 4];
+
+		sum += y;
+		max = MAX(max, y);
+		diff += abs(y - a->prev[i]);
+		a->prev[i] = y;
+	}
+	if (!a->has_prev) {
+		a->has_prev = true;
+		diff = ANALYTICS_GRID * ANALYTICS_GRID * 255;
+	}
+
+	/* less than half a code value per block is no motion */
+	if (diff * 2 < ANALYTICS_GRID * ANALYTICS_GRID)
+		a->still++;
+	else
+		a->still = 0;
+
+	var_SetFloat(sys->vd, "gles2-luma",
+		     sum / (255.f * ANALYTICS_GRID * ANALYTICS_GRID));
+	var_SetFloat(sys->vd, "gles2-motion",
+		     diff / (255.f * ANALYTICS_GRID * ANALYTICS_GRID));
+
+	/* the flags only change on transitions, so callbacks act as events */
+	black = max < ANALYTICS_BLACK;
+	if (black != a->black) {
+		fprintf(stderr, "MSG: analytics: black picture %s\n",
+			black ? "started" : "ended");
+		a->black = black;
+		var_SetBool(sys->vd, "gles2-black", black);
+	}
+	frozen = a->still >= ANALYTICS_FROZEN;
+	if (frozen != a->frozen) {
+		fprintf(stderr, "MSG: analytics: frozen picture %s\n",
+			frozen ? "started" : "ended");
+		a->frozen = frozen;
+		var_SetBool(sys->vd, "gles2-frozen", frozen);
+	}
+}
+
+/*
+ * Read back the target written ANALYTICS_DELAY pictures ago, before any
+ * work of the new picture is submitted.
+ */
+static void analytics_readback(vout_display_sys_t *vout)
+{
+	analytics_t *a = vout->analytics;
+	const unsigned slot = a->frame % ANALYTICS_DELAY;
+	GLubyte rgba[ANALYTICS_GRID * ANALYTICS_GRID * 4];
+
+	if (!a->pending[slot])
+		return;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, a->framebuffer[slot]);
+	glReadPixels(0, 0, ANALYTICS_GRID, ANALYTICS_GRID, GL_RGBA,
+		     GL_UNSIGNED_BYTE, rgba);
+	a->pending[slot] = false;
+	analytics_update(vout, rgba);
+}
+
+/*
+ * Reduce the Y plane still bound to the first unit after the conversion,
+ * into the target analytics_readback() emptied.
+ */
+static void do_analytics(vout_display_sys_t *vout)
+{
+	const GLfloat vVertices[] = {
+		-1.0f, -1.0f, 0.0f, 1.0f,
+		 1.0f, -1.0f, 1.0f, 1.0f,
+		 1.0f,  1.0f, 1.0f, 0.0f,
+		-1.0f,  1.0f, 0.0f, 0.0f,
+	};
+	analytics_t *a = vout->analytics;
+	const unsigned slot = a->frame % ANALYTICS_DELAY;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, a->framebuffer[slot]);
+	glViewport(0, 0, ANALYTICS_GRID, ANALYTICS_GRID);
+	glUseProgram(a->shader.program);
+	draw_quad(&a->shader, vVertices);
+	a->pending[slot] = true;
+	a->frame++;
+}
+
+static int autocrop_create(vout_display_sys_t *sys)
+{
+	autocrop_t *c;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return VLC_ENOMEM;
+
+	if (shader_init(sys->gl, &c->shader, SHADER_TYPE_CROP, NULL) < 0) {
+		fprintf(stderr, "ERR: %s: shader_init(CROP)\n", __func__);
+		free(c);
+		return VLC_EGENERIC;
+	}
+	glUniform1i(glGetUniformLocation(c->shader.program, "s_ytex"), Y_PLANE);
+
+	framebuffer_create(&c->framebuffer, &c->tex, CROP_GRID, CROP_GRID);
+
+	c->current[1] = c->current[3] = CROP_GRID;
+	sys->autocrop = c;
+	return VLC_SUCCESS;
+}
+
+static void autocrop_destroy(vout_display_sys_t *sys)
+{
+	autocrop_t *c = sys->autocrop;
+
+	if (!c)
+		return;
+
+	shader_delete(&c->shader);
+	textures_delete(1, &c->tex);
+	framebuffers_delete(1, &c->framebuffer);
+	free(c);
+	sys->autocrop = NULL;
+}
+
+/* bounds of everything brighter than a bar, false for a black picture */
+static bool autocrop_find(const GLubyte *rgba, unsigned bounds[4])
+{
+	unsigned top = CROP_GRID, bottom = 0, left = CROP_GRID, right = 0;
+
+	for (unsigned y = 0; y < CROP_GRID; y++) {
+		for (unsigned x = 0; x < CROP_GRID; x++) {
+			if (rgba[(y * CROP_GRID + x) * 4] < CROP_BLACK)
+				continue;
+			top = MIN(top, y);
+			bottom = MAX(bottom, y + 1);
+			left = MIN(left, x);
+			right = MAX(right, x + 1);
+		}
+	}
+	if (top >= bottom)
+		return false;
+
+	bounds[0] = top < CROP_MIN ? 0 : top;
+	bounds[1] = bottom > CROP_GRID - CROP_MIN ? CROP_GRID : bottom;
+	bounds[2] = left < CROP_MIN ? 0 : left;
+	bounds[3] = right > CROP_GRID - CROP_MIN ? CROP_GRID : right;
+	return true;
+}
+
+static void autocrop_apply(vout_display_sys_t *sys, const unsigned bounds[4])
+{
+	const video_format_t *f = &sys->vd->fmt;
+	rectangle_t *crop = &sys->gl->crop;
+	autocrop_t *c = sys->autocrop;
+
+	memcpy(c->current, bounds, sizeof(c->current));
+
+	/* rounded outwards, a bit of bar is better than a bit less picture */
+	crop->y = bounds[0] * f->i_height / CROP_GRID;
+	crop->height = (bounds[1] * f->i_height + CROP_GRID - 1) / CROP_GRID -
+		       crop->y;
+	crop->x = bounds[2] * f->i_width / CROP_GRID;
+	crop->width = (bounds[3] * f->i_width + CROP_GRID - 1) / CROP_GRID -
+		      crop->x;
+
+	fprintf(stderr, "MSG: autocrop: showing %ux%u+%u+%u\n",
+		crop->width, crop->height, crop->x, crop->y);
+	update_viewports(sys, sys->vd->cfg);
+}
+
+/*
+ * Picture showing up outside the crop widens it at once, but it only
+ * narrows once the same bounds were found CROP_STABLE times in a row.
+ */
+static void autocrop_update(vout_display_sys_t *sys)
+{
+	autocrop_t *c = sys->autocrop;
+	unsigned b[4];
+
+	if (!autocrop_find(c->rgba, b))
+		return;
+
+	if (b[0] < c->current[0] || b[1] > c->current[1] ||
+	    b[2] < c->current[2] || b[3] > c->current[3]) {
+		const unsigned grown[4] = {
+			MIN(b[0], c->current[0]), MAX(b[1], c->current[1]),
+			MIN(b[2], c->current[2]), MAX(b[3], c->current[3]),
+		};
+		c->stable = 0;
+		autocrop_apply(sys, grown);
+		return;
+	}
+
+	if (memcmp(b, c->candidate, sizeof(b))) {
+		memcpy(c->candidate, b, sizeof(b));
+		c->stable = 0;
+	}
+	if (++c->stable == CROP_STABLE && memcmp(b, c->current, sizeof(b)))
+		autocrop_apply(sys, b);
+}
+
+/* runs on the Y plane still bound to the first unit after the conversion */
+static void do_autocrop(vout_display_sys_t *vout)
+{
+	const GLfloat vVertices[] = {
+		-1.0f, -1.0f, 0.0f, 0.0f,
+		 1.0f, -1.0f, 1.0f, 0.0f,
+		 1.0f,  1.0f, 1.0f, 1.0f,
+		-1.0f,  1.0f, 0.0f, 1.0f,
+	};
+	autocrop_t *c = vout->autocrop;
+	mtime_t now;
+
+	/* the first row read back is the top of the picture */
+	if (c->pending) {
+		glBindFramebuffer(GL_FRAMEBUFFER, c->framebuffer);
+		glReadPixels(0, 0, CROP_GRID, CROP_GRID, GL_RGBA,
+			     GL_UNSIGNED_BYTE, c->rgba);
+		c->pending = false;
+		autocrop_update(vout);
+		return;
+	}
+
+	now = mdate();
+	if (now < c->next)
+		return;
+	c->next = now + CROP_INTERVAL;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, c->framebuffer);
+	glViewport(0, 0, CROP_GRID, CROP_GRID);
+	glUseProgram(c->shader.program);
+	draw_quad(&c->shader, vVertices);
+	c->pending = true;
+}
+
+#define FLAT_CHROMA_GRID   32
+#define FLAT_CHROMA_FRAMES 25
+
+/* sample a grid of both chroma planes for anything but neutral grey */
+static bool chroma_is_flat(const picture_t *p)
+{
+	for (int i = U_PLANE; i <= V_PLANE; i++) {
+		const plane_t *plane = &p->p[i];
+
+		for (int y = 0; y < FLAT_CHROMA_GRID; y++) {
+			const uint8_t *row = plane->p_pixels + plane->i_pitch *
+				(plane->i_visible_lines * y / FLAT_CHROMA_GRID);
+
+			for (int x = 0; x < FLAT_CHROMA_GRID; x++)
+				if (abs(row[plane->i_visible_pitch * x /
+					    FLAT_CHROMA_GRID] - 0x80) > 2)
+					return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * GREY pictures always take the luma only path, I420 only once its chroma
+ * stayed flat for FLAT_CHROMA_FRAMES, and leaves it with the first colour.
+ */
+static void update_luma_only(vout_display_sys_t *vout, const picture_t *p)
+{
+	if (p->i_planes == 1) {
+		vout->luma_only = true;
+		return;
+	}
+	if (!vout->flat_chroma_check)
+		return;
+
+	if (!chroma_is_flat(p)) {
+		if (vout->luma_only)
+			fprintf(stderr, "MSG: chroma is back, converting all planes\n");
+		vout->luma_only = false;
+		vout->flat_frames = 0;
+		return;
+	}
+	if (++vout->flat_frames == FLAT_CHROMA_FRAMES) {
+		fprintf(stderr, "MSG: chroma is flat, converting luma only\n");
+		vout->luma_only = true;
+	}
+}
+
+/* convert the picture into the framebuffer, false if it is not shown */
+static bool do_conversion(vout_display_sys_t *vout, picture_t *p)
+{
+	opengl_es2_t *gl = vout->gl;
+	bool shown = true;
+
+	if (vout->analytics)
+		analytics_readback(vout);
+	update_luma_only(vout, p);
+	if (gl->lut_tex) {
+		glActiveTexture(GL_TEXTURE0 + LUT_UNIT);
+		glBindTexture(GL_TEXTURE_2D, gl->lut_tex);
+	}
+	if (gl->hist_tex) {
+		denoise_swap(gl);
+		glActiveTexture(GL_TEXTURE0 + HIST_UNIT);
+		glBindTexture(GL_TEXTURE_2D, gl->hist_tex);
+	}
+
+	/* the weave needs the chroma of both fields */
+	if (vout->ivtc && !vout->luma_only)
+		shown = do_inverse_telecine(vout, p);
+	else
+		do_deinterlace_and_color_conversion(vout, p);
+
+	/* a dropped picture leaves the history as it was */
+	if (!shown && gl->hist_tex)
+		denoise_swap(gl);
+
+	if (shown && vout->analytics)
+		do_analytics(vout);
+	if (shown && vout->autocrop)
+		do_autocrop(vout);
+	return shown;
+}
+
+/*
+ * The inset texture is drawn from: fence the reads, or wait for them
+ * without EGL_KHR_fence_sync, and let the inset have the texture back.
+ */
+static void pip_consumed(vout_display_sys_t *vout)
+{
+	egl_backend_t *egl = vout->egl;
+	EGLSyncKHR fence = EGL_NO_SYNC_KHR;
+
+	if (egl->create_sync)
+		fence = egl->create_sync(egl->display, EGL_SYNC_FENCE_KHR, NULL);
+	if (fence != EGL_NO_SYNC_KHR)
+		glFlush();
+	else
+		glFinish();
+
+	vlc_mutex_lock(&pip.lock);
+	/* a newer fence also covers the reads before the older one */
+	if (pip.fence != EGL_NO_SYNC_KHR)
+		egl->destroy_sync(egl->display, pip.fence);
+	pip.fence = pip.inset ? fence : EGL_NO_SYNC_KHR;
+	if (!pip.inset && fence != EGL_NO_SYNC_KHR)
+		egl->destroy_sync(egl->display, fence);
+	pip.reading = 0;
+	vlc_cond_broadcast(&pip.wait);
+	vlc_mutex_unlock(&pip.lock);
+}
+
+static void pip_draw_inset(vout_display_sys_t *vout,
+			   const rectangle_t *viewport)
+{
+	/* the whole inset, neither cropped nor sharpened like the picture */
+	const GLfloat vVertices[] = {
+		-1.0f, -1.0f, 0.0f, 0.0f,
+		 1.0f, -1.0f, 1.0f, 0.0f,
+		 1.0f,  1.0f, 1.0f, 1.0f,
+		-1.0f,  1.0f, 0.0f, 1.0f,
+	};
+	const GLfloat vVerticesFlipped[] = {
+		-1.0f, -1.0f, 0.0f, 1.0f,
+		 1.0f, -1.0f, 1.0f, 1.0f,
+		 1.0f,  1.0f, 1.0f, 0.0f,
+		-1.0f,  1.0f, 0.0f, 0.0f,
+	};
+	const GLushort indices[] = {
+		0, 1, 2, 0, 2, 3
+	};
+	const opengl_es2_t *gl = vout->gl;
+	const gl_shader_t *shader = gl->copy.program ? &gl->copy : &gl->scale;
+	const GLfloat *v = gl->target_framebuffer ? vVerticesFlipped : vVertices;
+	unsigned width, height, margin;
+	GLuint texture;
+
+	vlc_mutex_lock(&pip.lock);
+	if (pip.host != vout || !pip.texture) {
+		vlc_mutex_unlock(&pip.lock);
+		return;
+	}
+	texture = pip.texture;
+	pip.reading = texture;
+	width = viewport->width * pip.size;
+	height = width / pip.aspect;
+	vlc_mutex_unlock(&pip.lock);
+
+	/* bottom right corner */
+	margin = viewport->height / 32;
+	if (gl->target_framebuffer)
+		margin = viewport->height - height - margin;
+	glViewport(viewport->x + viewport->width - width - viewport->width / 32,
+		   viewport->y + margin, width, height);
+
+	glUseProgram(shader->program);
+	glVertexAttribPointer(shader->position_loc, 2,
+			      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), v);
+	glVertexAttribPointer(shader->texcoord_loc, 2,
+			      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), &v[2]);
+	glEnableVertexAttribArray(shader->position_loc);
+	glEnableVertexAttribArray(shader->texcoord_loc);
+
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glUniform1i(glGetUniformLocation(shader->program, "s_tex"), 3);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+
+	pip_consumed(vout);
+}
+
+/*
+ * Hand the converted picture of an inset over to the main output. The next
+ * conversion goes to the other render target, once the main output is done
+ * reading it.
+ */
+static void pip_publish(vout_display_sys_t *vout)
+{
+	opengl_es2_t *gl = vout->gl;
+	egl_backend_t *egl = vout->egl;
+	EGLSyncKHR fence;
+	GLuint tmp;
+
+	/* the main output samples it from another context */
+	glFinish();
+
+	tmp = gl->framebuffer;
+	gl->framebuffer = gl->back_framebuffer;
+	gl->back_framebuffer = tmp;
+
+	tmp = gl->rgb_tex.id;
+	gl->rgb_tex.id = gl->back_tex;
+	gl->back_tex = tmp;
+
+	vlc_mutex_lock(&pip.lock);
+	if (pip.inset == vout)
+		pip.texture = gl->back_tex;
+	while (pip.inset == vout && pip.reading == gl->rgb_tex.id)
+		vlc_cond_wait(&pip.wait, &pip.lock);
+	fence = pip.fence;
+	pip.fence = EGL_NO_SYNC_KHR;
+	vlc_mutex_unlock(&pip.lock);
+
+	if (fence != EGL_NO_SYNC_KHR) {
+		egl->client_wait_sync(egl->display, fence,
+				      EGL_SYNC_FLUSH_COMMANDS_BIT_KHR,
+				      EGL_FOREVER_KHR);
+		egl->destroy_sync(egl->display, fence);
+	}
+}
+
+static int pip_attach(vout_display_sys_t *sys)
+{
+	const video_format_t *f = &sys->vd->source;
+	int ret = VLC_EGENERIC;
+
+	vlc_mutex_lock(&pip.lock);
+	if (!pip.host || pip.inset) {
+		fprintf(stderr, "ERR: %s: no output to attach the inset to\n",
+			__func__);
+		goto out;
+	}
+
+	ret = egl_backend_create_shared(&sys->egl, pip.host->egl);
+	if (ret != VLC_SUCCESS)
+		goto out;
+
+	pip.inset   = sys;
+	pip.texture = 0;
+	pip.size    = var_InheritFloat(sys->vd, "gles2-pip-size");
+	pip.aspect  = (float)f->i_visible_width / f->i_visible_height;
+	if (f->i_sar_num && f->i_sar_den)
+		pip.aspect = pip.aspect * f->i_sar_num / f->i_sar_den;
+	sys->is_inset = true;
+out:
+	vlc_mutex_unlock(&pip.lock);
+	return ret;
+}
+
+/*
+ * The first output opened is the one insets attach to. An inset left over
+ * from a closed main output shares objects with that one only, so it has
+ * to go away before a new main output can take over.
+ */
+static void pip_register_host(vout_display_sys_t *sys)
+{
+	vlc_mutex_lock(&pip.lock);
+	if (!pip.host && !pip.inset)
+		pip.host = sys;
+	vlc_mutex_unlock(&pip.lock);
+}
+
+static void pip_detach(vout_display_sys_t *sys)
+{
+	vlc_mutex_lock(&pip.lock);
+	if (pip.host == sys) {
+		/*
+		 * An attached inset keeps rendering, but nobody shows it. Its
+		 * context lives on the EGL display and X connection of this
+		 * output, so they stay open until the inset is gone.
+		 */
+		pip.host = NULL;
+		if (pip.inset) {
+			pip.orphan_owner = pip.inset;
+			pip.orphan_egl   = sys->egl->display;
+			pip.orphan_x11   = sys->x11->display;
+			sys->egl->shared = true;
+			sys->x11->keep_display = true;
+		}
+	}
+	if (pip.inset == sys) {
+		pip.inset   = NULL;
+		pip.texture = 0;
+		if (pip.fence != EGL_NO_SYNC_KHR)
+			sys->egl->destroy_sync(sys->egl->display, pip.fence);
+		pip.fence = EGL_NO_SYNC_KHR;
+	}
+	vlc_mutex_unlock(&pip.lock);
+}
+
+/* close what a main output left behind, once its inset is destroyed */
+static void pip_release(vout_display_sys_t *sys)
+{
+	EGLDisplay egl = EGL_NO_DISPLAY;
+	Display *x11 = NULL;
+
+	vlc_mutex_lock(&pip.lock);
+	if (pip.orphan_owner == sys) {
+		egl = pip.orphan_egl;
+		x11 = pip.orphan_x11;
+		pip.orphan_owner = NULL;
+		pip.orphan_egl   = EGL_NO_DISPLAY;
+		pip.orphan_x11   = NULL;
+	}
+	vlc_mutex_unlock(&pip.lock);
+
+	if (egl != EGL_NO_DISPLAY)
+		eglTerminate(egl);
+	if (x11)
+		XCloseDisplay(x11);
+}
+
+static void do_scaling(vout_display_sys_t *vout,
+		       const rectangle_t *viewport)
+{
+	GLfloat tc[4];
+	crop_texcoords(vout, tc);
+	/* the converted picture has its top row at t = 1 */
+	const GLfloat vVertices[] = {
+		-1.0f, -1.0f, tc[0], 1.0f - tc[3],
+		 1.0f, -1.0f, tc[2], 1.0f - tc[3],
+		 1.0f,  1.0f, tc[2], 1.0f - tc[1],
+		-1.0f,  1.0f, tc[0], 1.0f - tc[1],
+	};
+	/* images start at the top, the window at the bottom */
+	const GLfloat vVerticesFlipped[] = {
+		-1.0f, -1.0f, tc[0], 1.0f - tc[1],
+		 1.0f, -1.0f, tc[2], 1.0f - tc[1],
+		 1.0f,  1.0f, tc[2], 1.0f - tc[3],
+		-1.0f,  1.0f, tc[0], 1.0f - tc[3],
+	};
+	const GLushort indices[] = {
+		0, 1, 2, 0, 2, 3
+	};
+	opengl_es2_t *gl = vout->gl;
+	const GLfloat *v = gl->target_framebuffer ? vVerticesFlipped : vVertices;
+
+	glUseProgram(gl->scale.program);
+	/* everything is redrawn, nothing of the last frame is needed */
+	framebuffer_discard(gl, gl->target_framebuffer);
+
+	glViewport(viewport->x, viewport->y,
+			viewport->width, viewport->height);
+
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glVertexAttribPointer(gl->scale.position_loc, 2,
+			      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      v);
+	glVertexAttribPointer(gl->scale.texcoord_loc, 2,
+			      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      &v[2]);
+
+	glEnableVertexAttribArray(gl->scale.position_loc);
+	glEnableVertexAttribArray(gl->scale.texcoord_loc);
+
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, gl->output_tex);
+	glUniform1i(gl->rgb_tex.loc, 3);
+
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+
+	pip_draw_inset(vout, viewport);
+}
+
+static char *shader_read_file(const char *path, time_t *mtime)
+{
+	struct stat st;
+	char *src;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "ERR: %s: cannot open %s\n", __func__, path);
+		return NULL;
+	}
+	if (fstat(fileno(f), &st) < 0) {
+		fclose(f);
+		return NULL;
+	}
+
+	src = malloc(st.st_size + 1);
+	if (src) {
+		size_t len = fread(src, 1, st.st_size, f);
+		src[len] = '\0';
+	}
+	fclose(f);
+
+	*mtime = st.st_mtime;
+	return src;
+}
+
+static int shader_pass_load(shader_pass_t *pass)
+{
+	gl_shader_t shader = { 0 };
+	char *src;
+
+	src = shader_read_file(pass->path, &pass->mtime);
+	if (!src)
+		return -1;
+
+	if (shader_init(NULL, &shader, SHADER_TYPE_CUSTOM, src) < 0) {
+		fprintf(stderr, "ERR: %s: cannot build %s\n", __func__, pass->path);
+		free(src);
+		return -1;
+	}
+	free(src);
+
+	/* only replace a working pass by a working one */
+	shader_delete(&pass->shader);
+	pass->shader    = shader;
+	pass->tex_loc   = glGetUniformLocation(shader.program, "s_tex");
+	pass->texel_loc = glGetUniformLocation(shader.program, "texel_size");
+	return 0;
+}
+
+static void shader_chain_load(opengl_es2_t *gl, char *list)
+{
+	char *saveptr;
+
+	if (!list)
+		return;
+
+	for (char *path = strtok_r(list, ":", &saveptr); path;
+	     path = strtok_r(NULL, ":", &saveptr)) {
+		shader_pass_t *pass = &gl->chain[gl->chain_len];
+
+		if (gl->chain_len == MAX_CHAIN_PASSES) {
+			fprintf(stderr, "ERR: %s: more than %d passes, ignoring %s\n",
+				__func__, MAX_CHAIN_PASSES, path);
+			break;
+		}
+
+		pass->path = strdup(path);
+		if (!pass->path || shader_pass_load(pass) < 0) {
+			free(pass->path);
+			memset(pass, 0, sizeof(*pass));
+			continue;
+		}
+		fprintf(stderr, "MSG: post-processing pass %u: %s\n",
+			gl->chain_len, path);
+		gl->chain_len++;
+	}
+	free(list);
+}
+
+static void shader_chain_destroy(opengl_es2_t *gl)
+{
+	for (unsigned i = 0; i < gl->chain_len; i++) {
+		shader_delete(&gl->chain[i].shader);
+		free(gl->chain[i].path);
+	}
+	gl->chain_len = 0;
+}
+
+/*
+ * Run the post-processing passes on the converted picture and return the
+ * texture holding the result. Once a second the files are checked for
+ * changes. With the statistics shown that frame is also timed pass by pass,
+ * the glFinish() needed for that drains the pipeline and is not for free.
+ */
+static GLuint do_postprocess(vout_display_sys_t *vout, GLuint tex)
+{
+	const GLfloat vVertices[] = {
+		-1.0f, -1.0f, 0.0f, 0.0f,
+		 1.0f, -1.0f, 1.0f, 0.0f,
+		 1.0f,  1.0f, 1.0f, 1.0f,
+		-1.0f,  1.0f, 0.0f, 1.0f,
+	};
+	const GLushort indices[] = {
+		0, 1, 2, 0, 2, 3
+	};
+	const video_format_t *f = &vout->vd->fmt;
+	opengl_es2_t *gl = vout->gl;
+	bool measure = false;
+	mtime_t now, t = 0;
+
+	if (!gl->chain_len)
+		return tex;
+
+	now = mdate();
+	if (now >= gl->chain_check) {
+		gl->chain_check = now + CLOCK_FREQ;
+		measure = vout->stats != NULL;
+
+		for (unsigned i = 0; i < gl->chain_len; i++) {
+			struct stat st;
+
+			if (stat(gl->chain[i].path, &st) == 0 &&
+			    st.st_mtime != gl->chain[i].mtime) {
+				fprintf(stderr, "MSG: reloading %s\n", gl->chain[i].path);
+				shader_pass_load(&gl->chain[i]);
+			}
+		}
+	}
+	if (measure) {
+		glFinish();
+		t = mdate();
+	}
+
+	glViewport(0, 0, f->i_width, f->i_height);
+	glActiveTexture(GL_TEXTURE3);
+
+	for (unsigned i = 0; i < gl->chain_len; i++) {
+		shader_pass_t *pass = &gl->chain[i];
+
+		glBindFramebuffer(GL_FRAMEBUFFER, gl->chain_framebuffer[i % 2]);
+		glUseProgram(pass->shader.program);
+
+		glVertexAttribPointer(pass->shader.position_loc, 2,
+				      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+				      vVertices);
+		glVertexAttribPointer(pass->shader.texcoord_loc, 2,
+				      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+				      &vVertices[2]);
+		glEnableVertexAttribArray(pass->shader.position_loc);
+		glEnableVertexAttribArray(pass->shader.texcoord_loc);
+
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glUniform1i(pass->tex_loc, 3);
+		glUniform2fv(pass->texel_loc, 1, gl->chain_texel);
+
+		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+		tex = gl->chain_tex[i % 2];
+
+		if (measure) {
+			mtime_t end;
+
+			glFinish();
+			end = mdate();
+			pass->time = end - t;
+			t = end;
+		}
+	}
+	return tex;
+}
+
+static void opengl_es2_destroy(opengl_es2_t *gl)
+{
+	if (!gl)
+		return;
+
+	const GLuint framebuffers[] = {
+		gl->framebuffer,
+		gl->back_framebuffer,
+		gl->chain_framebuffer[0],
+		gl->chain_framebuffer[1],
+		gl->metric_framebuffer,
+		gl->hist_framebuffer
+	};
+	const GLuint textures[] = {
+		gl->tex[Y_PLANE].id,
+		gl->tex[U_PLANE].id,
+		gl->tex[V_PLANE].id,
+		gl->rgb_tex.id,
+		gl->back_tex,
+		gl->chain_tex[0],
+		gl->chain_tex[1],
+		gl->metric_tex,
+		gl->lut_tex,
+		gl->hist_tex
+	};
+
+	shader_delete(&gl->deint);
+	shader_delete(&gl->grey);
+	shader_delete(&gl->scale);
+	shader_delete(&gl->copy);
+	shader_delete(&gl->weave);
+	shader_delete(&gl->metric);
+	shader_chain_destroy(gl);
+	textures_delete(ARRAY_SIZE(gl->prev_tex), gl->prev_tex);
+
+	textures_delete(ARRAY_SIZE(textures), textures);
+	framebuffers_delete(ARRAY_SIZE(framebuffers), framebuffers);
+
+	memset(gl, 0, sizeof(*gl));
+	free(gl);
+	gl = NULL;
+}
+
+static inline bool opengl_have_extention(const char *extentions, const char *search)
+{
+	size_t len = strlen(search);
+	while (extentions) {
+		while (*extentions == ' ')
+			extentions++;
+		if ((strncmp(extentions, search, len) == 0) &&
+		    memchr(" ", extentions[len], 2))
+			return true;
+		extentions = strchr(extentions, ' ');
+	}
+	return false;
+}
+
+/* rebuild the scaler as its sharpening variant */
+static int sharpen_setup(opengl_es2_t *gl, float strength)
+{
+	gl_shader_t sharpen;
+
+	memset(&sharpen, 0, sizeof(sharpen));
+	if (shader_init(gl, &sharpen, SHADER_TYPE_COPY, "#define SHARPEN\n") < 0) {
+		fprintf(stderr, "ERR: %s: shader_init(SHARPEN)\n", __func__);
+		shader_delete(&sharpen);
+		return VLC_EGENERIC;
+	}
+	gl->copy = gl->scale;
+	gl->scale = sharpen;
+	gl->rgb_tex.loc = glGetUniformLocation(gl->scale.program, "s_tex");
+	glUniform1f(glGetUniformLocation(gl->scale.program, "sharpen_strength"),
+		    strength);
+	gl->sharpen = strength;
+
+	fprintf(stderr, "MSG: sharpening, strength %.2f\n", strength);
+	return VLC_SUCCESS;
+}
+
+static int opengl_es2_create(opengl_es2_t **p_gl, const char *defines)
+{
+	opengl_es2_t *gl;
+
+	gl = calloc(1, sizeof(*gl));
+	if (!gl)
+		return VLC_ENOMEM;
+
+	shader_precision_init(gl);
+	if (defines)
+		strncpy(gl->defines, defines, sizeof(gl->defines) - 1);
+
+	if (shader_init(gl, &gl->deint, SHADER_TYPE_DEINT_LINEAR, gl->defines) < 0) {
+		fprintf(stderr, "ERR: %s: shader_init(DEINT)\n", __func__);
+		goto cleanup;
+	}
+
+	gl->tex[Y_PLANE].id = texture_create(GL_NEAREST);
+	gl->tex[Y_PLANE].loc = glGetUniformLocation(gl->deint.program, "s_ytex");
+
+	gl->tex[U_PLANE].id = texture_create(GL_NEAREST);
+	gl->tex[U_PLANE].loc = glGetUniformLocation(gl->deint.program, "s_utex");
+
+	gl->tex[V_PLANE].id = texture_create(GL_NEAREST);
+	gl->tex[V_PLANE].loc = glGetUniformLocation(gl->deint.program, "s_vtex");
+
+	if (shader_init(gl, &gl->grey, SHADER_TYPE_GREY, gl->defines) < 0) {
+		fprintf(stderr, "ERR: %s: shader_init(GREY)\n", __func__);
+		goto cleanup;
+	}
+	glUniform1i(glGetUniformLocation(gl->grey.program, "s_ytex"), Y_PLANE);
+
+	if (shader_init(gl, &gl->scale, SHADER_TYPE_COPY, NULL) < 0) {
+		fprintf(stderr, "ERR: %s: shader_init(SCALE)\n", __func__);
+		goto cleanup;
+	}
+	gl->rgb_tex.loc = glGetUniformLocation(gl->scale.program, "s_tex");
+
+	/* The rest is done when pool is requested */
+
+#if GL_UNPACK_ROW_LENGTH
+	/* check for extentions we can use */
+	{
+		const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+		fprintf(stderr, "MSG: available extentions:\n   %s\n", extensions);
+
+		gl->has_unpack_row = opengl_have_extention(extensions, "GL_EXT_unpack_subimage");
+		fprintf(stderr, "MSG: have %sunpack_row support\n",
+			gl->has_unpack_row ? "" : "no ");
+
+		if (opengl_have_extention(extensions, "GL_OES_EGL_image"))
+			gl->image_target_texture = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)
+				eglGetProcAddress("glEGLImageTargetTexture2DOES");
+
+		if (opengl_have_extention(extensions, "GL_EXT_discard_framebuffer"))
+			gl->discard_framebuffer = (PFNGLDISCARDFRAMEBUFFEREXTPROC)
+				eglGetProcAddress("glDiscardFramebufferEXT");
+		fprintf(stderr, "MSG: have %sframebuffer discard support\n",
+			gl->discard_framebuffer ? "" : "no ");
+	}
+#endif
+
+	*p_gl = gl;
+	return VLC_SUCCESS;
+
+cleanup:
+	shader_delete(&gl->deint);
+	shader_delete(&gl->grey);
+	shader_delete(&gl->scale);
+
+	free(gl);
+	gl = NULL;
+	return VLC_EGENERIC;
+}
+
+/* planar YUV the conversion shaders can sample directly */
+static bool is_supported_chroma(vlc_fourcc_t chroma)
+{
+	return chroma == VLC_CODEC_I420 ||
+	       chroma == VLC_CODEC_I422 ||
+	       chroma == VLC_CODEC_I444 ||
+	       chroma == VLC_CODEC_GREY;
+}
+
+/*
+ * Pick the chroma VLC delivers: --chroma if it can be converted here, else
+ * the chroma of the video, else its closest fallback that can. The core
+ * only inserts a converter when none of the video's own formats is native.
+ */
+static vlc_fourcc_t negotiate_chroma(vout_display_t *vd)
+{
+	const vlc_fourcc_t *fallback;
+	vlc_fourcc_t chroma = 0;
+	char *forced;
+
+	forced = var_InheritString(vd, "chroma");
+	if (forced) {
+		chroma = vlc_fourcc_GetCodecFromString(VIDEO_ES, forced);
+		if (!is_supported_chroma(chroma)) {
+			fprintf(stderr, "ERR: %s: chroma %s is not supported\n",
+				__func__, forced);
+			chroma = 0;
+		}
+		free(forced);
+	}
+
+	if (!chroma && is_supported_chroma(vd->fmt.i_chroma))
+		chroma = vd->fmt.i_chroma;
+
+	fallback = vlc_fourcc_GetYUVFallback(vd->fmt.i_chroma);
+	for (; !chroma && fallback && *fallback; fallback++)
+		if (is_supported_chroma(*fallback))
+			chroma = *fallback;
+
+	if (!chroma)
+		chroma = VLC_CODEC_I420;
+
+	fprintf(stderr, "MSG: %s: %4.4s in, %4.4s out\n", __func__,
+		(const char *)&vd->fmt.i_chroma, (const char *)&chroma);
+	return chroma;
+}
+
+/*
+ * The chroma planes are sampled with the same normalized coordinates as
+ * luma, only the vertical distance between their lines differs.
+ */
+static void opengl_es2_set_chroma(vout_display_sys_t *vout)
+{
+	const vlc_chroma_description_t *c;
+	opengl_es2_t *gl = vout->gl;
+	GLfloat scale;
+
+	c = vlc_fourcc_GetChromaDescription(vout->vd->fmt.i_chroma);
+	if (c->plane_count < 3)
+		return;
+	scale = (GLfloat)c->p[U_PLANE].h.num / c->p[U_PLANE].h.den;
+
+	glUseProgram(gl->deint.program);
+	glUniform1f(glGetUniformLocation(gl->deint.program, "chroma_scale"),
+		    scale);
+	if (vout->ivtc) {
+		glUseProgram(gl->weave.program);
+		glUniform1f(glGetUniformLocation(gl->weave.program,
+						 "chroma_scale"), scale);
+	}
+}
+
+static void stats_draw(vout_display_sys_t *);
+
+/*
+ * Many drivers defer the real shader compilation, and recompiles depending
+ * on the bound texture formats and render target, until the first draw.
+ * Run one black picture through every program with the real formats before
+ * the first picture arrives, so the first frame does not pay for it. The
+ * programs this picture does not take, the blend of IVTC, luma only of the
+ * flat chroma check, the statistics and the inset copy, draw it once too.
+ */
+static void opengl_es2_warmup(vout_display_sys_t *vout)
+{
+	const GLfloat vVertices[] = {
+		-1.0f, -1.0f, 0.0f, 1.0f,
+		 1.0f, -1.0f, 1.0f, 1.0f,
+		 1.0f,  1.0f, 1.0f, 0.0f,
+		-1.0f,  1.0f, 0.0f, 0.0f,
+	};
+	opengl_es2_t *gl = vout->gl;
+	picture_t *p;
+	mtime_t t;
+
+	p = picture_NewFromFormat(&vout->vd->fmt);
+	if (!p) {
+		fprintf(stderr, "ERR: %s: picture_NewFromFormat failed\n", __func__);
+		return;
+	}
+	for (int i = 0; i < p->i_planes; i++)
+		memset(p->p[i].p_pixels, i == Y_PLANE ? 0x10 : 0x80,
+		       p->p[i].i_pitch * p->p[i].i_lines);
+
+	t = mdate();
+
+	do_conversion(vout, p);
+	/* the weave took the black picture, blended frames use deint */
+	if (vout->ivtc && !vout->luma_only)
+		do_deinterlace_and_color_conversion(vout, p);
+	if (vout->flat_chroma_check && !vout->luma_only) {
+		vout->luma_only = true;
+		do_deinterlace_and_color_conversion(vout, p);
+		vout->luma_only = false;
+	}
+	gl->output_tex = do_postprocess(vout, gl->rgb_tex.id);
+	do_scaling(vout, &gl->viewport);
+	stats_draw(vout);
+	/* what pip_draw_inset() uses when the scaler sharpens */
+	if (gl->copy.program) {
+		glUseProgram(gl->copy.program);
+		glActiveTexture(GL_TEXTURE3);
+		glBindTexture(GL_TEXTURE_2D, gl->rgb_tex.id);
+		glUniform1i(glGetUniformLocation(gl->copy.program, "s_tex"), 3);
+		draw_quad(&gl->copy, vVertices);
+	}
+	/* the result is never swapped, do_scaling() clears it again */
+	glFinish();
+
+	fprintf(stderr, "MSG: shader warm-up took %"PRId64"us\n", mdate() - t);
+
+	/* the black picture must not count for the 3:2 cadence */
+	vout->flat_frames = 0;
+	if (vout->ivtc)
+		memset(vout->ivtc, 0, sizeof(*vout->ivtc));
+	if (vout->analytics)
+		analytics_reset(vout->analytics);
+	if (vout->autocrop) {
+		vout->autocrop->pending = false;
+		vout->autocrop->next = 0;
+	}
+
+	picture_Release(p);
+}
+
+#ifdef HAVE_LINUX_UDMABUF_H
+static void dmabuf_picture_destroy(picture_t *p)
+{
+	picture_sys_t *buf = p->p_sys;
+
+	munmap(buf->base, buf->size);
+	close(buf->dmabuf);
+	close(buf->memfd);
+	free(buf);
+	free(p);
+}
+
+static picture_t *dmabuf_picture_create(vout_display_sys_t *sys, int dev)
+{
+	const video_format_t *f = &sys->vd->fmt;
+	const vlc_chroma_description_t *c;
+	struct udmabuf_create create;
+	picture_resource_t rsc;
+	picture_sys_t *buf;
+	picture_t *p;
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	c = vlc_fourcc_GetChromaDescription(f->i_chroma);
+	if (!c)
+		return NULL;
+
+	buf = calloc(1, sizeof(*buf));
+	if (!buf)
+		return NULL;
+	buf->owner = sys;
+
+	memset(&rsc, 0, sizeof(rsc));
+	for (unsigned i = 0; i < c->plane_count; i++) {
+		unsigned width = f->i_width * c->p[i].w.num / c->p[i].w.den;
+
+		rsc.p[i].i_lines = f->i_height * c->p[i].h.num / c->p[i].h.den;
+		rsc.p[i].i_pitch = (width * c->pixel_size + 63) & ~63;
+		buf->offset[i] = buf->size;
+		buf->size += rsc.p[i].i_pitch * rsc.p[i].i_lines;
+	}
+	buf->size = (buf->size + page - 1) / page * page;
+
+	/* udmabuf wants sealed memfd memory it can pin */
+	buf->memfd = memfd_create("vlc-gles2", MFD_ALLOW_SEALING);
+	if (buf->memfd < 0)
+		goto error;
+	if (ftruncate(buf->memfd, buf->size) < 0 ||
+	    fcntl(buf->memfd, F_ADD_SEALS, F_SEAL_SHRINK) < 0)
+		goto error_memfd;
+
+	create.memfd  = buf->memfd;
+	create.flags  = UDMABUF_FLAGS_CLOEXEC;
+	create.offset = 0;
+	create.size   = buf->size;
+	buf->dmabuf = ioctl(dev, UDMABUF_CREATE, &create);
+	if (buf->dmabuf < 0)
+		goto error_memfd;
+
+	buf->base = mmap(NULL, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 buf->memfd, 0);
+	if (buf->base == MAP_FAILED)
+		goto error_dmabuf;
+	/* the decoder gets it first */
+	dmabuf_cpu_access(buf, true);
+
+	for (unsigned i = 0; i < c->plane_count; i++)
+		rsc.p[i].p_pixels = (uint8_t *)buf->base + buf->offset[i];
+	rsc.p_sys = buf;
+	rsc.pf_destroy = dmabuf_picture_destroy;
+
+	p = picture_NewFromResource(f, &rsc);
+	if (!p)
+		goto error_map;
+	return p;
+
+error_map:
+	munmap(buf->base, buf->size);
+error_dmabuf:
+	close(buf->dmabuf);
+error_memfd:
+	close(buf->memfd);
+error:
+	fprintf(stderr, "ERR: %s: failed to create dma-buf picture\n", __func__);
+	free(buf);
+	return NULL;
+}
+
+/*
+ * Pool of pictures the GPU can sample in place. Falls back to a regular
+ * pool (and texture uploads) when anything on the way is missing.
+ */
+static picture_pool_t *dmabuf_pool_create(vout_display_sys_t *sys,
+					  unsigned count)
+{
+	picture_t *pictures[count];
+	picture_pool_t *pool;
+	unsigned n;
+	int dev;
+
+	if (!sys->egl->has_dmabuf_import || !sys->gl->image_target_texture)
+		return NULL;
+
+	sys->dmabufs = calloc(count, sizeof(*sys->dmabufs));
+	if (!sys->dmabufs)
+		return NULL;
+
+	dev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (dev < 0) {
+		fprintf(stderr, "ERR: %s: cannot open /dev/udmabuf\n", __func__);
+		goto error;
+	}
+
+	for (n = 0; n < count; n++) {
+		pictures[n] = dmabuf_picture_create(sys, dev);
+		if (!pictures[n])
+			break;
+		sys->dmabufs[n] = pictures[n]->p_sys;
+	}
+	close(dev);
+	if (n < count)
+		goto error_pictures;
+
+	pool = picture_pool_New(count, pictures);
+	if (!pool)
+		goto error_pictures;
+
+	sys->num_dmabufs = count;
+	fprintf(stderr, "MSG: using %u dma-buf backed pictures\n", count);
+	return pool;
+
+error_pictures:
+	while (n--)
+		picture_Release(pictures[n]);
+error:
+	free(sys->dmabufs);
+	sys->dmabufs = NULL;
+	return NULL;
+}
+#endif
+
+/* 3x5 glyphs, one bit per pixel, top row in the highest bits */
+static const char stats_charset[] = " 0123456789abcdefghijklmnopqrstuvwxyz.:/%-=";
+static const uint16_t stats_glyphs[] = {
+		0x0000, 0x7b6f, 0x2c97, 0x73e7, 0x73cf, 0x5bc9, 0x79cf, 0x79ef,
+		0x7252, 0x7bef, 0x7bcf, 0x2bed, 0x6bae, 0x3923, 0x6b6e, 0x79a7,
+		0x79a4, 0x396b, 0x5bed, 0x7497, 0x126a, 0x5bad, 0x4927, 0x5fed,
+		0x6b6d, 0x2b6a, 0x6ba4, 0x2b73, 0x6bad, 0x388e, 0x7492, 0x5b6f,
+		0x5b6a, 0x5bfd, 0x5aad, 0x5a92, 0x72a7, 0x0002, 0x0410, 0x12a4,
+		0x52a5, 0x01c0, 0x0e38,
+};
+
+#define GLYPH_W 4 /* 3 pixels and a blank column */
+#define GLYPH_H 6 /* 5 pixels and a blank row */
+#define GLYPH_SCALE 2
+
+static int stats_create(vout_display_sys_t *sys)
+{
+	const unsigned count = ARRAY_SIZE(stats_glyphs);
+	GLubyte atlas[GLYPH_H][ARRAY_SIZE(stats_glyphs) * GLYPH_W];
+	stats_t *stats;
+
+	stats = calloc(1, sizeof(*stats));
+	if (!stats)
+		return VLC_ENOMEM;
+
+	if (shader_init(sys->gl, &stats->shader, SHADER_TYPE_OVERLAY, NULL) < 0) {
+		fprintf(stderr, "ERR: %s: shader_init(OVERLAY)\n", __func__);
+		free(stats);
+		return VLC_EGENERIC;
+	}
+	stats->font_loc = glGetUniformLocation(stats->shader.program, "s_tex");
+
+	memset(atlas, 0, sizeof(atlas));
+	for (unsigned g = 0; g < count; g++)
+		for (unsigned y = 0; y < 5; y++)
+			for (unsigned x = 0; x < 3; x++)
+				if (stats_glyphs[g] & (1 << (14 - y * 3 - x)))
+					atlas[y][g * GLYPH_W + x] = 0xff;
+
+	stats->font = texture_create(GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, count * GLYPH_W, GLYPH_H,
+		     0, GL_LUMINANCE, GL_UNSIGNED_BYTE, atlas);
+
+	stats->since = mdate();
+	sys->stats = stats;
+	return VLC_SUCCESS;
+}
+
+static void stats_destroy(vout_display_sys_t *sys)
+{
+	stats_t *stats = sys->stats;
+
+	if (!stats)
+		return;
+
+	shader_delete(&stats->shader);
+	textures_delete(1, &stats->font);
+	free(stats);
+	sys->stats = NULL;
+}
+
+static void stats_add_frame(vout_display_sys_t *sys, const picture_t *p,
+			    const mtime_t stage[STAGE_COUNT])
+{
+	stats_t *stats = sys->stats;
+
+	if (!stats)
+		return;
+
+	stats->frames++;
+	/* shown more than a frame after its date */
+	if (mdate() > p->date + CLOCK_FREQ / 50)
+		stats->late++;
+	for (unsigned i = 0; i < STAGE_COUNT; i++)
+		stats->stage[i] += stage[i];
+}
+
+static void stats_drop(vout_display_sys_t *sys)
+{
+	if (sys->stats)
+		sys->stats->dropped++;
+}
+
+/* lay out text lines as quads, in pixels from the top left corner */
+static void stats_layout(stats_t *stats, const rectangle_t *win, bool flip,
+			 const char *const *lines, unsigned num_lines)
+{
+	const GLfloat sx = 2.0 * GLYPH_W * GLYPH_SCALE / win->width;
+	const GLfloat sy = 2.0 * GLYPH_H * GLYPH_SCALE / win->height;
+	const GLfloat tw = 1.0 / ARRAY_SIZE(stats_glyphs);
+	GLfloat *v = stats->vertices;
+	unsigned n = 0;
+
+	for (unsigned l = 0; l < num_lines; l++) {
+		for (const char *c = lines[l]; *c && n < STATS_CHARS; c++, n++) {
+			const char *g = strchr(stats_charset, tolower(*c));
+			const GLfloat s0 = g ? (g - stats_charset) * tw : 0.f;
+			const GLfloat x0 = -1.0 + sx * (c - lines[l] + 1);
+			GLfloat y0 = 1.0 - sy * (l + 1), y1 = 1.0 - sy * (l + 2);
+			const GLfloat quad[6][4] = {
+				{ x0,      y0, s0,      0.f },
+				{ x0 + sx, y0, s0 + tw, 0.f },
+				{ x0 + sx, y1, s0 + tw, 1.f },
+				{ x0,      y0, s0,      0.f },
+				{ x0 + sx, y1, s0 + tw, 1.f },
+				{ x0,      y1, s0,      1.f },
+			};
+
+			memcpy(v, quad, sizeof(quad));
+			if (flip)
+				for (unsigned i = 0; i < 6; i++)
+					v[i * 4 + 1] = -v[i * 4 + 1];
+			v += 6 * 4;
+		}
+	}
+	stats->count = n * 6;
+}
+
+static const char *upload_path(const vout_display_sys_t *sys)
+{
+	if (sys->num_dmabufs)
+		return "dma-buf";
+	return sys->gl->has_unpack_row ? "unpack row" : "copy";
+}
+
+static void stats_update(vout_display_sys_t *sys)
+{
+	stats_t *stats = sys->stats;
+	const mtime_t now = mdate();
+	const mtime_t elapsed = now - stats->since;
+	const opengl_es2_t *gl = sys->gl;
+	char line[4][64];
+	const char *const lines[] = { line[0], line[1], line[2], line[3] };
+	unsigned frames = stats->frames ? stats->frames : 1;
+	size_t len;
+	bool flip = false;
+
+	if (elapsed < STATS_REFRESH)
+		return;
+
+	snprintf(line[0], sizeof(line[0]), "fps %.1f late %u drop %u",
+		 stats->frames * (double)CLOCK_FREQ / elapsed, stats->late,
+		 stats->dropped);
+	snprintf(line[1], sizeof(line[1]), "conv %"PRId64" post %"PRId64
+		 " scale %"PRId64" us", stats->stage[STAGE_CONVERT] / frames,
+		 stats->stage[STAGE_POST] / frames,
+		 stats->stage[STAGE_SCALE] / frames);
+	snprintf(line[2], sizeof(line[2]), "upload %s%s", upload_path(sys),
+		 sys->luma_only ? " y only" : "");
+	/* the last timed frame of do_postprocess() */
+	len = snprintf(line[3], sizeof(line[3]), "pass");
+	for (unsigned i = 0; i < gl->chain_len && len < sizeof(line[3]); i++)
+		len += snprintf(line[3] + len, sizeof(line[3]) - len,
+				" %"PRId64, gl->chain[i].time);
+	if (len < sizeof(line[3]))
+		snprintf(line[3] + len, sizeof(line[3]) - len, " us");
+
+#ifdef HAVE_XCB_PRESENT
+	flip = sys->present != NULL;
+#endif
+	stats_layout(stats, &sys->x11->rect, flip, lines,
+		     ARRAY_SIZE(lines) - !gl->chain_len);
+
+	stats->frames = stats->late = stats->dropped = 0;
+	memset(stats->stage, 0, sizeof(stats->stage));
+	stats->since = now;
+}
+
+/* the last pass, over the whole window */
+static void stats_draw(vout_display_sys_t *sys)
+{
+	stats_t *stats = sys->stats;
+
+	if (!stats)
+		return;
+
+	stats_update(sys);
+	if (!stats->count)
+		return;
+
+	glViewport(0, 0, sys->x11->rect.width, sys->x11->rect.height);
+	glUseProgram(stats->shader.program);
+
+	glVertexAttribPointer(stats->shader.position_loc, 2,
+			      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      stats->vertices);
+	glVertexAttribPointer(stats->shader.texcoord_loc, 2,
+			      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      &stats->vertices[2]);
+	glEnableVertexAttribArray(stats->shader.position_loc);
+	glEnableVertexAttribArray(stats->shader.texcoord_loc);
+
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, stats->font);
+	glUniform1i(stats->font_loc, 3);
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDrawArrays(GL_TRIANGLES, 0, stats->count);
+	glDisable(GL_BLEND);
+}
+
+static int wall_open_shm(wall_t *wall, const char *name)
+{
+	const size_t size = WALL_SCREENS * sizeof(wall_slot_t);
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return VLC_EGENERIC;
+	/* the first screen to get there sizes it, the slots start zeroed */
+	if (fstat(fd, &st) || ((size_t)st.st_size < size && ftruncate(fd, size))) {
+		close(fd);
+		return VLC_EGENERIC;
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return VLC_EGENERIC;
+
+	wall->shm_name = strdup(name);
+	wall->slots = map;
+	return VLC_SUCCESS;
+}
+
+/*
+ * The last screen to leave removes the slots, the next wall starts over
+ * from zeroed ones. A screen opening them at the same time may end up on
+ * its own until the wall is restarted.
+ */
+static void wall_close_shm(wall_t *wall)
+{
+	const mtime_t now = mdate();
+	bool last = true;
+
+	/* gone, the others stop waiting for this screen at once */
+	atomic_store(&wall->slots[wall->screen].seen, 0);
+	for (unsigned i = 0; i < WALL_SCREENS; i++) {
+		const mtime_t seen = atomic_load(&wall->slots[i].seen);
+
+		if (seen && now - seen <= WALL_ABSENT)
+			last = false;
+	}
+	munmap(wall->slots, WALL_SCREENS * sizeof(wall_slot_t));
+	if (last && wall->shm_name)
+		shm_unlink(wall->shm_name);
+	free(wall->shm_name);
+}
+
+static int wall_open_udp(wall_t *wall, const char *addr)
+{
+	const char *port = strrchr(addr, ':');
+	struct sockaddr_in any = { .sin_family = AF_INET };
+	char host[64];
+	int on = 1;
+
+	if (!port || port == addr || (size_t)(port - addr) >= sizeof(host))
+		return VLC_EGENERIC;
+	memcpy(host, addr, port - addr);
+	host[port - addr] = '\0';
+
+	wall->group.sin_family = AF_INET;
+	wall->group.sin_port = htons(atoi(port + 1));
+	if (!inet_aton(host, &wall->group.sin_addr) || !wall->group.sin_port)
+		return VLC_EGENERIC;
+
+	wall->slots = calloc(WALL_SCREENS, sizeof(*wall->slots));
+	if (!wall->slots)
+		return VLC_ENOMEM;
+
+	wall->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (wall->fd < 0)
+		goto error;
+	/* every screen of this host listens on the same port */
+	setsockopt(wall->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	setsockopt(wall->fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+	any.sin_port = wall->group.sin_port;
+	if (bind(wall->fd, (struct sockaddr *)&any, sizeof(any)))
+		goto error_socket;
+
+	if (IN_MULTICAST(ntohl(wall->group.sin_addr.s_addr))) {
+		struct ip_mreq mreq = {
+			.imr_multiaddr = wall->group.sin_addr,
+			.imr_interface.s_addr = htonl(INADDR_ANY),
+		};
+
+		if (setsockopt(wall->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+			       &mreq, sizeof(mreq)))
+			goto error_socket;
+	}
+	return VLC_SUCCESS;
+
+error_socket:
+	close(wall->fd);
+error:
+	free(wall->slots);
+	wall->slots = NULL;
+	return VLC_EGENERIC;
+}
+
+static int wall_create(vout_display_sys_t *sys, const char *tile)
+{
+	unsigned col, row;
+	char *sync;
+	wall_t *wall;
+	int ret = VLC_SUCCESS;
+
+	wall = calloc(1, sizeof(*wall));
+	if (!wall)
+		return VLC_ENOMEM;
+
+	if (sscanf(tile, "%ux%u+%u+%u", &wall->cols, &wall->rows,
+		   &col, &row) != 4 || !wall->cols || !wall->rows ||
+	    wall->cols * wall->rows > WALL_SCREENS ||
+	    col >= wall->cols || row >= wall->rows) {
+		fprintf(stderr, "ERR: %s: bad tile '%s'\n", __func__, tile);
+		free(wall);
+		return VLC_EGENERIC;
+	}
+	wall->screen = row * wall->cols + col;
+	wall->fd = -1;
+
+	sync = var_InheritString(sys->vd, "gles2-wall-sync");
+	if (sync && !strncmp(sync, "shm:", 4)) {
+		wall->sync = WALL_SYNC_SHM;
+		ret = wall_open_shm(wall, sync + 4);
+	} else if (sync && !strncmp(sync, "udp:", 4)) {
+		wall->sync = WALL_SYNC_UDP;
+		ret = wall_open_udp(wall, sync + 4);
+	} else if (sync) {
+		ret = VLC_EGENERIC;
+	}
+	if (ret != VLC_SUCCESS) {
+		fprintf(stderr, "ERR: %s: no swap sync through '%s'\n",
+			__func__, sync);
+		wall->sync = WALL_SYNC_NONE;
+	}
+	free(sync);
+
+	fprintf(stderr, "MSG: wall: screen %u of %ux%u\n", wall->screen,
+		wall->cols, wall->rows);
+	sys->wall = wall;
+	return VLC_SUCCESS;
+}
+
+static void wall_destroy(vout_display_sys_t *sys)
+{
+	wall_t *wall = sys->wall;
+
+	if (!wall)
+		return;
+
+	switch (wall->sync) {
+	case WALL_SYNC_SHM:
+		wall_close_shm(wall);
+		break;
+	case WALL_SYNC_UDP:
+		close(wall->fd);
+		free(wall->slots);
+		break;
+	default:
+		break;
+	}
+	free(wall->scratch);
+	free(wall);
+	sys->wall = NULL;
+}
+
+/* the tile of this screen, in picture pixels */
+static void wall_crop(vout_display_sys_t *sys)
+{
+	const video_format_t *f = &sys->vd->fmt;
+	const wall_t *wall = sys->wall;
+	const unsigned col = wall->screen % wall->cols;
+	const unsigned row = wall->screen / wall->cols;
+	rectangle_t *crop = &sys->gl->crop;
+
+	crop->x = col * f->i_width / wall->cols;
+	crop->y = row * f->i_height / wall->rows;
+	crop->width = (col + 1) * f->i_width / wall->cols - crop->x;
+	crop->height = (row + 1) * f->i_height / wall->rows - crop->y;
+}
+
+static void wall_receive(wall_t *wall, mtime_t now)
+{
+	wall_packet_t pkt;
+
+	while (recv(wall->fd, &pkt, sizeof(pkt), 0) == sizeof(pkt)) {
+		const unsigned screen = ntohl(pkt.screen);
+
+		if (ntohl(pkt.magic) != WALL_MAGIC || screen >= WALL_SCREENS ||
+		    screen == wall->screen)
+			continue;
+		atomic_store_explicit(&wall->slots[screen].frame,
+				      be64toh(pkt.frame), memory_order_relaxed);
+		atomic_store_explicit(&wall->slots[screen].seen, now,
+				      memory_order_relaxed);
+	}
+}
+
+/*
+ * The lowest swap count of the live screens, or the highest one if
+ * highest is set.
+ */
+static uint64_t wall_frames(const wall_t *wall, mtime_t now, bool highest)
+{
+	uint64_t frames = highest ? 0 : UINT64_MAX;
+
+	for (unsigned i = 0; i < wall->cols * wall->rows; i++) {
+		const wall_slot_t *slot = &wall->slots[i];
+		const mtime_t seen = atomic_load(&slot->seen);
+		const uint64_t frame = atomic_load(&slot->frame);
+
+		if (i == wall->screen || !seen || now - seen > WALL_ABSENT)
+			continue;
+		frames = highest ? MAX(frames, frame) : MIN(frames, frame);
+	}
+	return frames;
+}
+
+/* announce the next swap and wait until every live screen did the same */
+static void wall_sync(vout_display_sys_t *sys)
+{
+	wall_t *wall = sys->wall;
+	const mtime_t start = mdate();
+	mtime_t now = start;
+
+	if (!wall || wall->sync == WALL_SYNC_NONE)
+		return;
+
+	if (wall->sync == WALL_SYNC_UDP)
+		wall_receive(wall, now);
+	wall->frame = MAX(wall->frame + 1, wall_frames(wall, now, true));
+
+	atomic_store(&wall->slots[wall->screen].frame, wall->frame);
+	atomic_store(&wall->slots[wall->screen].seen, now);
+	if (wall->sync == WALL_SYNC_UDP) {
+		const wall_packet_t pkt = {
+			.magic  = htonl(WALL_MAGIC),
+			.screen = htonl(wall->screen),
+			.frame  = htobe64(wall->frame),
+		};
+
+		sendto(wall->fd, &pkt, sizeof(pkt), 0,
+		       (struct sockaddr *)&wall->group, sizeof(wall->group));
+	}
+
+	while (wall_frames(wall, now, false) < wall->frame) {
+		if (now - start > WALL_TIMEOUT) {
+			wall->timeouts++;
+			break;
+		}
+		if (wall->sync == WALL_SYNC_UDP) {
+			struct pollfd pfd = { .fd = wall->fd, .events = POLLIN };
+
+			poll(&pfd, 1, 1);
+			wall_receive(wall, mdate());
+		} else {
+			msleep(CLOCK_FREQ / 10000);
+		}
+		now = mdate();
+	}
+
+	wall->swaps++;
+	wall->wait_max = MAX(wall->wait_max, now - start);
+	if (now >= wall->report) {
+		fprintf(stderr, "MSG: wall: %u swaps, %u timed out, longest "
+			"wait %"PRId64"us\n", wall->swaps, wall->timeouts,
+			wall->wait_max);
+		wall->swaps = wall->timeouts = 0;
+		wall->wait_max = 0;
+		wall->report = now + CLOCK_FREQ;
+	}
+}
+
+#ifdef HAVE_XCB_PRESENT
+static void present_buffers_destroy(vout_display_sys_t *sys)
+{
+	present_t *present = sys->present;
+
+	for (unsigned i = 0; i < PRESENT_PIXMAPS; i++) {
+		present_buffer_t *buf = &present->buf[i];
+
+		if (buf->framebuffer)
+			framebuffers_delete(1, &buf->framebuffer);
+		if (buf->tex)
+			textures_delete(1, &buf->tex);
+		if (buf->image != EGL_NO_IMAGE_KHR)
+			sys->egl->destroy_image(sys->egl->display, buf->image);
+		if (buf->pixmap)
+			XFreePixmap(sys->x11->display, buf->pixmap);
+		memset(buf, 0, sizeof(*buf));
+	}
+	present->width = present->height = 0;
+}
+
+static int present_buffers_create(vout_display_sys_t *sys)
+{
+	const EGLint attr[] = {
+		EGL_IMAGE_PRESERVED_KHR, EGL_TRUE,
+		EGL_NONE
+	};
+	present_t *present = sys->present;
+	x11_backend_t *x11 = sys->x11;
+	XWindowAttributes wa;
+
+	XGetWindowAttributes(x11->display, x11->window, &wa);
+
+	for (unsigned i = 0; i < PRESENT_PIXMAPS; i++) {
+		present_buffer_t *buf = &present->buf[i];
+
+		buf->pixmap = XCreatePixmap(x11->display, x11->window,
+					    x11->rect.width, x11->rect.height,
+					    wa.depth);
+		XSync(x11->display, False);
+
+		buf->image = sys->egl->create_image(sys->egl->display,
+						    EGL_NO_CONTEXT,
+						    EGL_NATIVE_PIXMAP_KHR,
+						    (EGLClientBuffer)buf->pixmap,
+						    attr);
+		if (buf->image == EGL_NO_IMAGE_KHR) {
+			fprintf(stderr, "ERR: %s: eglCreateImageKHR failed: 0x%x\n",
+				__func__, eglGetError());
+			goto error;
+		}
+
+		glGenFramebuffers(1, &buf->framebuffer);
+		gl_objects++;
+		buf->tex = texture_create(GL_NEAREST);
+		sys->gl->image_target_texture(GL_TEXTURE_2D, buf->image);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, buf->framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				       GL_TEXTURE_2D, buf->tex, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+		    GL_FRAMEBUFFER_COMPLETE) {
+			fprintf(stderr, "ERR: %s: pixmap not renderable\n", __func__);
+			goto error;
+		}
+	}
+
+	present->width  = x11->rect.width;
+	present->height = x11->rect.height;
+	return VLC_SUCCESS;
+
+error:
+	present_buffers_destroy(sys);
+	return VLC_EGENERIC;
+}
+
+static void present_destroy(vout_display_sys_t *sys)
+{
+	present_t *present = sys->present;
+
+	if (!present)
+		return;
+
+	present_buffers_destroy(sys);
+	if (present->events)
+		xcb_unregister_for_special_event(present->conn, present->events);
+	free(present);
+	sys->present = NULL;
+}
+
+static int present_create(vout_display_sys_t *sys)
+{
+	xcb_present_query_version_reply_t *version;
+	present_t *present;
+
+	if (!sys->egl->has_image_pixmap || !sys->gl->image_target_texture) {
+		fprintf(stderr, "ERR: %s: cannot render into pixmaps\n", __func__);
+		return VLC_EGENERIC;
+	}
+
+	present = calloc(1, sizeof(*present));
+	if (!present)
+		return VLC_ENOMEM;
+	sys->present = present;
+
+	present->conn = XGetXCBConnection(sys->x11->display);
+
+	version = xcb_present_query_version_reply(present->conn,
+		xcb_present_query_version(present->conn, 1, 0), NULL);
+	if (!version) {
+		fprintf(stderr, "ERR: %s: no Present extension\n", __func__);
+		goto error;
+	}
+	free(version);
+
+	present->eid = xcb_generate_id(present->conn);
+	xcb_present_select_input(present->conn, present->eid, sys->x11->window,
+				 XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY |
+				 XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY);
+	present->events = xcb_register_for_special_xge(present->conn,
+						       &xcb_present_id,
+						       present->eid, NULL);
+	if (!present->events)
+		goto error;
+
+	return VLC_SUCCESS;
+
+error:
+	present_destroy(sys);
+	return VLC_EGENERIC;
+}
+
+static void present_handle_event(present_t *present, xcb_generic_event_t *ev)
+{
+	const xcb_present_generic_event_t *ge = (void *)ev;
+
+	if (ge->evtype == XCB_PRESENT_COMPLETE_NOTIFY) {
+		const xcb_present_complete_notify_event_t *ce = (void *)ev;
+		mtime_t ust = ce->ust;
+
+		if (ce->kind != XCB_PRESENT_COMPLETE_KIND_PIXMAP)
+			return;
+
+		/* the vblank clock, ust and mdate() are both CLOCK_MONOTONIC */
+		if (present->last_ust && ce->msc > present->last_msc) {
+			mtime_t period = (ust - present->last_ust) /
+					 (mtime_t)(ce->msc - present->last_msc);
+
+			present->period = present->period ?
+				(present->period * 7 + period) / 8 : period;
+		}
+		present->last_ust = ust;
+		present->last_msc = ce->msc;
+
+		if (ce->mode == XCB_PRESENT_COMPLETE_MODE_SKIP)
+			present->skipped++;
+
+		for (unsigned i = 0; i < PRESENT_PIXMAPS; i++) {
+			present_buffer_t *buf = &present->buf[i];
+			mtime_t error;
+
+			if (buf->serial != ce->serial || !buf->date)
+				continue;
+
+			/* shown after the vblank it was queued for */
+			if (buf->target && ce->msc > buf->target)
+				present->missed++;
+			error = llabs(ust - buf->date);
+			present->error_sum += error;
+			if (error > present->error_max)
+				present->error_max = error;
+			present->presented++;
+		}
+	} else if (ge->evtype == XCB_PRESENT_IDLE_NOTIFY) {
+		const xcb_present_idle_notify_event_t *ie = (void *)ev;
+
+		for (unsigned i = 0; i < PRESENT_PIXMAPS; i++)
+			if (present->buf[i].pixmap == ie->pixmap)
+				present->buf[i].busy = false;
+	}
+}
+
+static void present_handle_events(present_t *present)
+{
+	xcb_generic_event_t *ev;
+
+	while ((ev = xcb_poll_for_special_event(present->conn, present->events))) {
+		present_handle_event(present, ev);
+		free(ev);
+	}
+}
+
+/*
+ * An idle pixmap, waiting for the server to release one. Should it never
+ * say so, e.g. after the window was unmapped, the oldest one is taken back
+ * after PRESENT_TIMEOUT. NULL if the connection is gone.
+ */
+static present_buffer_t *present_idle_buffer(present_t *present)
+{
+	const mtime_t deadline = mdate() + PRESENT_TIMEOUT;
+	struct pollfd ufd = {
+		.fd     = xcb_get_file_descriptor(present->conn),
+		.events = POLLIN,
+	};
+	present_buffer_t *oldest = &present->buf[0];
+	mtime_t left;
+
+	for (;;) {
+		xcb_generic_event_t *ev;
+
+		for (unsigned i = 0; i < PRESENT_PIXMAPS; i++)
+			if (!present->buf[i].busy)
+				return &present->buf[i];
+
+		ev = xcb_poll_for_special_event(present->conn, present->events);
+		if (ev) {
+			present_handle_event(present, ev);
+			free(ev);
+			continue;
+		}
+		if (xcb_connection_has_error(present->conn))
+			return NULL;
+
+		left = deadline - mdate();
+		if (left <= 0)
+			break;
+		/* Xlib may read our events off the socket, look again soon */
+		poll(&ufd, 1, MIN(left, CLOCK_FREQ / 200) / 1000 + 1);
+	}
+
+	for (unsigned i = 1; i < PRESENT_PIXMAPS; i++)
+		if ((int32_t)(present->buf[i].serial - oldest->serial) < 0)
+			oldest = &present->buf[i];
+	fprintf(stderr, "ERR: %s: no idle pixmap after %"PRId64"ms, "
+		"reusing serial %"PRIu32"\n", __func__,
+		PRESENT_TIMEOUT / 1000, oldest->serial);
+	oldest->busy = false;
+	return oldest;
+}
+
+/*
+ * Render the frame into an idle pixmap and queue it for the vblank
+ * closest to the picture date.
+ */
+static void present_frame(vout_display_sys_t *sys, picture_t *p)
+{
+	present_t *present = sys->present;
+	present_buffer_t *buf = NULL;
+	uint32_t options = XCB_PRESENT_OPTION_NONE;
+	uint64_t target = 0;
+	mtime_t now;
+
+	present_handle_events(present);
+
+	if (present->width != sys->x11->rect.width ||
+	    present->height != sys->x11->rect.height) {
+		present_buffers_destroy(sys);
+		if (present_buffers_create(sys) != VLC_SUCCESS)
+			return;
+	}
+
+	buf = present_idle_buffer(present);
+	if (!buf)
+		return;
+
+	sys->gl->target_framebuffer = buf->framebuffer;
+	do_scaling(sys, &sys->gl->viewport);
+	stats_draw(sys);
+	sys->gl->target_framebuffer = 0;
+	/* the X server reads the pixmap without any fence */
+	glFinish();
+
+	/* low latency flips at once, even if it tears */
+	if (sys->egl->latency != LATENCY_NORMAL) {
+		options = XCB_PRESENT_OPTION_ASYNC;
+	} else if (present->period && present->last_ust) {
+		mtime_t delta = p->date - present->last_ust;
+
+		target = present->last_msc + 1;
+		if (delta > present->period)
+			target = present->last_msc +
+				 (delta + present->period / 2) / present->period;
+	}
+
+	wall_sync(sys);
+	buf->busy   = true;
+	buf->serial = ++present->serial;
+	buf->target = target;
+	buf->date   = p->date;
+	xcb_present_pixmap(present->conn, sys->x11->window, buf->pixmap,
+			   buf->serial, None, None, 0, 0, None, None, None,
+			   options, target, 0, 0, 0, NULL);
+	xcb_flush(present->conn);
+
+	now = mdate();
+	if (now >= present->report) {
+		if (present->presented)
+			fprintf(stderr, "MSG: presented %u frames, %u skipped, "
+				"%u missed, error avg %"PRId64"us max %"PRId64"us, "
+				"vblank %"PRId64"us\n", present->presented,
+				present->skipped, present->missed,
+				present->error_sum / present->presented,
+				present->error_max, present->period);
+		present->presented = present->skipped = present->missed = 0;
+		present->error_sum = present->error_max = 0;
+		present->report = now + CLOCK_FREQ;
+	}
+}
+#endif
+
+/*
+ * Parse a CPU list like "0,2-3".
+ */
+static int sched_parse_cpus(const char *list, cpu_set_t *set)
+{
+	CPU_ZERO(set);
+	while (*list) {
+		char *end;
+		long first, last;
+
+		first = last = strtol(list, &end, 10);
+		if (end == list || first < 0)
+			return VLC_EGENERIC;
+		if (*end == '-') {
+			list = end + 1;
+			last = strtol(list, &end, 10);
+			if (end == list || last < first)
+				return VLC_EGENERIC;
+		}
+		if (last >= CPU_SETSIZE)
+			return VLC_EGENERIC;
+		for (long cpu = first; cpu <= last; cpu++)
+			CPU_SET(cpu, set);
+
+		list = end;
+		if (*list == ',')
+			list++;
+		else if (*list)
+			return VLC_EGENERIC;
+	}
+	return CPU_COUNT(set) ? VLC_SUCCESS : VLC_EGENERIC;
+}
+
+static int sched_create(vout_display_sys_t *sys)
+{
+	vout_display_t *vd = sys->vd;
+	const video_format_t *f = &vd->source;
+	int priority = var_InheritInteger(vd, "gles2-rt-priority");
+	char *cpus = var_InheritString(vd, "gles2-cpus");
+	char *policy;
+	sched_t *s;
+
+	if (!priority && !cpus)
+		return VLC_SUCCESS;
+
+	s = calloc(1, sizeof(*s));
+	if (!s) {
+		free(cpus);
+		return VLC_ENOMEM;
+	}
+
+	if (cpus) {
+		if (sched_parse_cpus(cpus, &s->cpus) == VLC_SUCCESS)
+			s->pin = true;
+		else
+			fprintf(stderr, "ERR: %s: bad CPU list '%s'\n",
+				__func__, cpus);
+		free(cpus);
+	}
+
+	s->policy = SCHED_FIFO;
+	policy = var_InheritString(vd, "gles2-rt-policy");
+	if (policy && !strcmp(policy, "rr"))
+		s->policy = SCHED_RR;
+	else if (policy && strcmp(policy, "fifo"))
+		fprintf(stderr, "ERR: %s: unknown policy '%s', using fifo\n",
+			__func__, policy);
+	free(policy);
+	if (priority)
+		s->priority = VLC_CLIP(priority,
+				       sched_get_priority_min(s->policy),
+				       sched_get_priority_max(s->policy));
+
+	if (f->i_frame_rate && f->i_frame_rate_base)
+		s->period = CLOCK_FREQ * f->i_frame_rate_base /
+			    f->i_frame_rate;
+	sys->sched = s;
+	return VLC_SUCCESS;
+}
+
+static void sched_apply(sched_t *s)
+{
+	int err;
+
+	s->thread  = pthread_self();
+	s->applied = true;
+	s->report  = mdate() + CLOCK_FREQ;
+
+	if (s->priority) {
+		struct sched_param param = { .sched_priority = s->priority };
+		struct rlimit limit;
+
+		pthread_getschedparam(s->thread, &s->old_policy, &s->old_param);
+		err = pthread_setschedparam(s->thread, s->policy, &param);
+		/* unprivileged users may still get up to RLIMIT_RTPRIO */
+		if (err == EPERM && !getrlimit(RLIMIT_RTPRIO, &limit) &&
+		    limit.rlim_cur > 0 && limit.rlim_cur < (rlim_t)s->priority) {
+			param.sched_priority = limit.rlim_cur;
+			err = pthread_setschedparam(s->thread, s->policy, &param);
+		}
+		if (err) {
+			fprintf(stderr, "ERR: %s: no real-time priority: %s\n",
+				__func__, strerror(err));
+			s->priority = 0;
+		} else {
+			fprintf(stderr, "MSG: display thread at %s priority %d\n",
+				s->policy == SCHED_RR ? "SCHED_RR" : "SCHED_FIFO",
+				param.sched_priority);
+		}
+	}
+
+	if (s->pin) {
+		pthread_getaffinity_np(s->thread, sizeof(s->old_cpus),
+				       &s->old_cpus);
+		err = pthread_setaffinity_np(s->thread, sizeof(s->cpus),
+					     &s->cpus);
+		if (err)
+			fprintf(stderr, "ERR: %s: not pinned: %s\n",
+				__func__, strerror(err));
+		else
+			fprintf(stderr, "MSG: display thread pinned to %d CPUs\n",
+				CPU_COUNT(&s->cpus));
+		s->pinned = !err;
+	}
+}
+
+static void sched_destroy(vout_display_sys_t *sys)
+{
+	sched_t *s = sys->sched;
+
+	if (!s)
+		return;
+
+	/* the thread outlives the display, give it back as it was */
+	if (s->applied && pthread_equal(s->thread, pthread_self())) {
+		if (s->priority)
+			pthread_setschedparam(s->thread, s->old_policy,
+					      &s->old_param);
+		if (s->pinned)
+			pthread_setaffinity_np(s->thread, sizeof(s->old_cpus),
+					       &s->old_cpus);
+	}
+	free(s);
+	sys->sched = NULL;
+}
+
+static long sched_switches(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_THREAD, &usage))
+		return 0;
+	return usage.ru_nivcsw;
+}
+
+static void sched_begin(vout_display_sys_t *sys)
+{
+	sched_t *s = sys->sched;
+
+	if (!s)
+		return;
+	if (!s->applied)
+		sched_apply(s);
+	s->begin = sched_switches();
+}
+
+static void sched_end(vout_display_sys_t *sys, const picture_t *p)
+{
+	sched_t *s = sys->sched;
+	const mtime_t now = mdate();
+	long switches;
+
+	if (!s)
+		return;
+
+	switches = sched_switches() - s->begin;
+	s->frames++;
+	s->switches += switches;
+	if (switches)
+		s->preempted++;
+	/* the vout waits for the date, a frame later the vblank is gone */
+	if (s->period && now > p->date + s->period)
+		s->late++;
+
+	if (now < s->report)
+		return;
+
+	fprintf(stderr, "MSG: sched: %u frames, %u preempted (%ld "
+		"involuntary switches), %u late\n", s->frames, s->preempted,
+		s->switches, s->late);
+	s->frames = s->preempted = s->late = 0;
+	s->switches = 0;
+	s->report = now + CLOCK_FREQ;
+}
+
+/*
+ * Rough size of the textures behind a picture: its planes, twice with
+ * inverse telecine, the RGB render targets and the LUT.
+ */
+static uint64_t gpu_memory(const vout_display_sys_t *sys, const picture_t *p)
 {
-	static const vlc_chroma_description_t *c = NULL;
-	const video_format_t *const f = &vout->vd->fmt;
-	opengl_es2_t *gl = vout->gl;
-	GLbyte *buf, *dst, *src;
-
-	fprintf(stderr, "> %s()\n", __func__);
+	const opengl_es2_t *gl = sys->gl;
+	const uint64_t rgb = (uint64_t)p->format.i_width *
+			     p->format.i_height * 4;
+	uint64_t size = 0;
+
+	for (int i = 0; i < p->i_planes; i++)
+		size += (uint64_t)p->p[i].i_visible_pitch *
+			p->p[i].i_visible_lines;
+	if (sys->ivtc)
+		size *= 2;
+
+	size += rgb;
+	if (gl->hist_tex)
+		size += rgb;
+	if (gl->back_tex)
+		size += rgb;
+	if (gl->chain_len)
+		size += 2 * rgb;
+	if (gl->lut_tex)
+		size += (uint64_t)(gl->lut_size * gl->lut_size * gl->lut_size) * 3;
+	return size;
+}
 
-	if (!c)
-		c = vlc_fourcc_GetChromaDescription(f->i_chroma);
+static void metrics_add_frame(vout_display_sys_t *sys, const picture_t *p,
+			      const mtime_t stage[STAGE_COUNT])
+{
+	metrics_t *m = sys->metrics;
 
-	for (unsigned i = 0; i < p->i_planes; i++) {
-		unsigned rows = f->i_visible_height * c->p[i].h.num / c->p[i].h.den;
-		unsigned line = f->i_visible_width * c->p[i].w.num / c->p[i].w.den;
+	if (!m)
+		return;
 
-		dst = buf = alloca(line * rows);
-		src = p->p[i].p_pixels;
+	atomic_fetch_add_explicit(&m->displayed, 1, memory_order_relaxed);
+	if (mdate() > p->date + CLOCK_FREQ / 50)
+		atomic_fetch_add_explicit(&m->late, 1, memory_order_relaxed);
+	for (unsigned i = 0; i < STAGE_COUNT && stage; i++)
+		atomic_fetch_add_explicit(&m->stage[i], stage[i],
+					  memory_order_relaxed);
+	atomic_store_explicit(&m->gpu_memory, gpu_memory(sys, p),
+			      memory_order_relaxed);
+	atomic_store_explicit(&m->upload, upload_path(sys),
+			      memory_order_relaxed);
+	atomic_store_explicit(&m->luma_only, sys->luma_only,
+			      memory_order_relaxed);
+}
 
-		for (unsigned r = 0; r < rows; r++) {
-			memcpy(dst, src, line);
-			src += p->p[i].i_pitch / p->p[i].i_pixel_pitch;
-			dst += line;
-		}
+static void metrics_drop(vout_display_sys_t *sys)
+{
+	if (sys->metrics)
+		atomic_fetch_add_explicit(&sys->metrics->dropped, 1,
+					  memory_order_relaxed);
+}
 
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(GL_TEXTURE_2D, gl->tex[i].id);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, line, rows,
-			     0, GL_LUMINANCE, GL_UNSIGNED_BYTE, buf);
-		glUniform1i(gl->tex[i].loc, i);
-	}
-	fprintf(stderr, "< %s()\n", __func__);
+static size_t metrics_printf(char *buf, size_t size, size_t len,
+			     const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (len >= size)
+		return len;
+	va_start(ap, fmt);
+	n = vsnprintf(buf + len, size - len, fmt, ap);
+	va_end(ap);
+	return n < 0 ? len : MIN(len + n, size);
 }
 
-static void update_textures_simple(vout_display_sys_t *vout, picture_t *p)
+#define METRIC(name, type, help) \
+	"# HELP gles2_" name " " help "\n# TYPE gles2_" name " " type "\n"
+
+static size_t metrics_format(metrics_t *m, char *buf, size_t size)
 {
-	opengl_es2_t *gl = vout->gl;
+	static const char *const stages[STAGE_COUNT] = {
+		[STAGE_CONVERT] = "convert",
+		[STAGE_POST]    = "post",
+		[STAGE_SCALE]   = "scale",
+	};
+	const char *upload = atomic_load_explicit(&m->upload,
+						  memory_order_relaxed);
+	size_t len = 0;
+
+#define LOAD(counter) \
+	(unsigned long long)atomic_load_explicit(&m->counter, \
+						 memory_order_relaxed)
+	len = metrics_printf(buf, size, len,
+		METRIC("frames_displayed_total", "counter", "Pictures shown.")
+		"gles2_frames_displayed_total %llu\n"
+		METRIC("frames_dropped_total", "counter",
+		       "Pictures not shown, like 3:2 pulldown repeats.")
+		"gles2_frames_dropped_total %llu\n"
+		METRIC("frames_late_total", "counter",
+		       "Pictures shown more than 20ms after their date.")
+		"gles2_frames_late_total %llu\n"
+		METRIC("resize_events_total", "counter",
+		       "Changes of the display size.")
+		"gles2_resize_events_total %llu\n"
+		METRIC("gpu_memory_bytes", "gauge",
+		       "Estimated size of the textures of this display.")
+		"gles2_gpu_memory_bytes %llu\n"
+		METRIC("luma_only", "gauge",
+		       "1 while only the luma plane is uploaded.")
+		"gles2_luma_only %d\n"
+		METRIC("stage_seconds_total", "counter",
+		       "Time spent in each rendering stage."),
+		LOAD(displayed), LOAD(dropped), LOAD(late), LOAD(resizes),
+		LOAD(gpu_memory),
+		atomic_load_explicit(&m->luma_only, memory_order_relaxed));
+	for (unsigned i = 0; i < STAGE_COUNT; i++)
+		len = metrics_printf(buf, size, len,
+			"gles2_stage_seconds_total{stage=\"%s\"} %.6f\n",
+			stages[i], LOAD(stage[i]) / (double)CLOCK_FREQ);
+#undef LOAD
+	if (upload)
+		len = metrics_printf(buf, size, len,
+			METRIC("upload_path", "gauge",
+			       "How the pictures reach the GPU.")
+			"gles2_upload_path{path=\"%s\"} 1\n", upload);
+	return len;
+}
 
-	for (unsigned i = 0; i < p->i_planes; i++) {
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(GL_TEXTURE_2D, gl->tex[i].id);
-		glPixelStorei(GL_UNPACK_ROW_LENGTH, p->p[i].i_pitch / p->p[i].i_pixel_pitch);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, p->p[i].i_visible_pitch, p->p[i].i_visible_lines,
-		             0, GL_LUMINANCE, GL_UNSIGNED_BYTE, p->p[i].p_pixels);
-		glUniform1i(gl->tex[i].loc, i);
+static void metrics_send(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		buf += n;
+		len -= n;
 	}
-	/* reset row packing */
-	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 }
 
-static void update_textures(vout_display_sys_t *vout, picture_t *p)
+static void metrics_serve(metrics_t *m, int client)
 {
-	if (vout->gl->has_unpack_row)
-		update_textures_simple(vout, p);
-	else
-		update_textures_complex(vout, p);
+	struct pollfd pfd = { .fd = client, .events = POLLIN };
+	char body[2048], head[128], req[256];
+	size_t len;
+	bool http = false;
+
+	/* Prometheus asks over HTTP, a plain reader may send nothing */
+	if (poll(&pfd, 1, 100) > 0) {
+		ssize_t n = recv(client, req, sizeof(req), 0);
+
+		http = n >= 4 && !memcmp(req, "GET ", 4);
+	}
+
+	len = metrics_format(m, body, sizeof(body));
+	if (http)
+		metrics_send(client, head, snprintf(head, sizeof(head),
+			     "HTTP/1.0 200 OK\r\n"
+			     "Content-Type: text/plain; version=0.0.4\r\n"
+			     "Content-Length: %zu\r\n\r\n", len));
+	metrics_send(client, body, len);
 }
 
-static void do_deinterlace_and_color_conversion(vout_display_sys_t *vout, picture_t *p)
+static void *metrics_thread(void *data)
 {
-	const GLfloat vVertices[] = {
-		-1.0f, -1.0f, 0.0f, 1.0f,
-		 1.0f, -1.0f, 1.0f, 1.0f,
-		 1.0f,  1.0f, 1.0f, 0.0f,
-		-1.0f,  1.0f, 0.0f, 0.0f,
-	};
-	const GLushort indices[] = {
-		0, 1, 2, 0, 2, 3
+	metrics_t *m = data;
+	struct pollfd fds[2] = {
+		{ .fd = m->fd,      .events = POLLIN },
+		{ .fd = m->wake[0], .events = POLLIN },
 	};
-	const GLuint height = p->format.i_height;
-	const GLuint width = p->format.i_width;
-	opengl_es2_t *gl = vout->gl;
-	GLint line_height_loc;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, gl->framebuffer);
-	glUseProgram(gl->deint.program);
+	for (;;) {
+		int client;
 
-	glViewport(0, 0, width, height);
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[1].revents)
+			break;
+
+		client = accept(m->fd, NULL, NULL);
+		if (client < 0)
+			continue;
+		metrics_serve(m, client);
+		close(client);
+	}
+	return NULL;
+}
 
-	glVertexAttribPointer(gl->deint.position_loc, 2,
-			      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
-			      vVertices);
-	glVertexAttribPointer(gl->deint.texcoord_loc, 2,
-			      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
-			      &vVertices[2]);
+static int metrics_listen(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
 
-	glEnableVertexAttribArray(gl->deint.position_loc);
-	glEnableVertexAttribArray(gl->deint.texcoord_loc);
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+	strcpy(addr.sun_path, path);
 
-	update_textures(vout, p);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
 
-	line_height_loc = glGetUniformLocation(gl->deint.program, "line_height");
-	glUniform1f(line_height_loc, 1.0/height);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		int probe;
+
+		if (errno != EADDRINUSE)
+			goto error;
+
+		/* left behind by a player that is gone, not a live one */
+		probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (probe >= 0 &&
+		    connect(probe, (struct sockaddr *)&addr, sizeof(addr)) &&
+		    errno == ECONNREFUSED)
+			unlink(path);
+		if (probe >= 0)
+			close(probe);
+		if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+			goto error;
+	}
 
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+	if (listen(fd, 8))
+		goto error;
+	return fd;
+
+error:
+	close(fd);
+	return -1;
 }
 
-static void do_scaling(vout_display_sys_t *vout,
-					    picture_t *p)
+static int metrics_create(vout_display_sys_t *sys, char *path)
 {
-	const GLfloat vVertices[] = {
-		-1.0f, -1.0f, 0.0f, 0.0f,
-		 1.0f, -1.0f, 1.0f, 0.0f,
-		 1.0f,  1.0f, 1.0f, 1.0f,
-		-1.0f,  1.0f, 0.0f, 1.0f,
-	};
-	const GLushort indices[] = {
-		0, 1, 2, 0, 2, 3
-	};
-	opengl_es2_t *gl = vout->gl;
+	metrics_t *m;
 
-	glUseProgram(gl->scale.program);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	m = calloc(1, sizeof(*m));
+	if (!m) {
+		free(path);
+		return VLC_ENOMEM;
+	}
+	m->path = path;
 
-	glViewport(gl->viewport.x, gl->viewport.y,
-			gl->viewport.width, gl->viewport.height);
+	m->fd = metrics_listen(path);
+	if (m->fd < 0) {
+		fprintf(stderr, "ERR: %s: cannot listen on %s: %s\n",
+			__func__, path, strerror(errno));
+		goto error;
+	}
+	if (pipe(m->wake))
+		goto error_socket;
+	if (vlc_clone(&m->thread, metrics_thread, m, VLC_THREAD_PRIORITY_LOW))
+		goto error_pipe;
 
-	glClear(GL_COLOR_BUFFER_BIT);
+	sys->metrics = m;
+	return VLC_SUCCESS;
 
-	glVertexAttribPointer(gl->scale.position_loc, 2,
-			      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
-			      vVertices);
-	glVertexAttribPointer(gl->scale.texcoord_loc, 2,
-			      GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
-			      &vVertices[2]);
+error_pipe:
+	close(m->wake[0]);
+	close(m->wake[1]);
+error_socket:
+	close(m->fd);
+	unlink(path);
+error:
+	free(path);
+	free(m);
+	return VLC_EGENERIC;
+}
 
-	glEnableVertexAttribArray(gl->scale.position_loc);
-	glEnableVertexAttribArray(gl->scale.texcoord_loc);
+static void metrics_destroy(vout_display_sys_t *sys)
+{
+	metrics_t *m = sys->metrics;
 
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, gl->rgb_tex.id);
-	glUniform1i(gl->rgb_tex.loc, 3);
+	if (!m)
+		return;
 
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+	if (write(m->wake[1], "", 1) != 1)
+		fprintf(stderr, "ERR: %s: cannot wake the thread\n", __func__);
+	vlc_join(m->thread, NULL);
+	close(m->wake[0]);
+	close(m->wake[1]);
+	close(m->fd);
+	unlink(m->path);
+	free(m->path);
+	free(m);
+	sys->metrics = NULL;
 }
 
-static void opengl_es2_destroy(opengl_es2_t *gl)
+static int soak_create(vout_display_sys_t *sys)
 {
-	if (!gl)
-		return;
+	soak_t *soak;
 
-	const GLuint framebuffers[] = {
-		gl->framebuffer
-	};
-	const GLuint textures[] = {
-		gl->tex[Y_PLANE].id,
-		gl->tex[U_PLANE].id,
-		gl->tex[V_PLANE].id,
-		gl->rgb_tex.id
-	};
+	soak = calloc(1, sizeof(*soak));
+	if (!soak)
+		return VLC_ENOMEM;
 
-	shader_delete(&gl->deint);
-	shader_delete(&gl->scale);
+	if (sys->x11)
+		soak->size = sys->x11->rect;
+	soak->window_end = mdate() + SOAK_WINDOW;
+	sys->soak = soak;
+	return VLC_SUCCESS;
+}
 
-	glDeleteTextures(ARRAY_SIZE(textures), textures);
-	glDeleteFramebuffers(ARRAY_SIZE(framebuffers), framebuffers);
+static void soak_destroy(vout_display_sys_t *sys)
+{
+	if (!sys->soak)
+		return;
 
-	memset(gl, 0, sizeof(*gl));
-	free(gl);
-	gl = NULL;
+	if (sys->soak->failures)
+		fprintf(stderr, "ERR: soak: FAILED, %u drifts in %u windows\n",
+			sys->soak->failures, sys->soak->windows);
+	else
+		fprintf(stderr, "MSG: soak: passed, %u windows\n",
+			sys->soak->windows);
+	free(sys->soak);
+	sys->soak = NULL;
 }
 
-static inline bool opengl_have_extention(const char *extentions, const char *search)
+/* resident set size in kB */
+static long soak_rss(void)
 {
-	size_t len = strlen(search);
-	while (extentions) {
-		while (*extentions == ' ')
-			extentions++;
-		if ((strncmp(extentions, search, len) == 0) &&
-		    memchr(" ", extentions[len], 2))
-			return true;
-		extentions = strchr(extentions, ' ');
-	}
-	return false;
+	FILE *f = fopen("/proc/self/statm", "r");
+	long size, resident = 0;
+
+	if (!f)
+		return 0;
+	if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+		resident = 0;
+	fclose(f);
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
 }
 
-static int opengl_es2_create(opengl_es2_t **p_gl)
+/* what decides the objects and memory a display needs */
+static void soak_key(const vout_display_sys_t *sys, char *key, size_t size)
 {
-	opengl_es2_t *gl;
-
-	gl = calloc(1, sizeof(*gl));
-	if (!gl)
-		return VLC_ENOMEM;
+	const vout_display_t *vd = sys->vd;
+	const opengl_es2_t *gl = sys->gl;
+
+	snprintf(key, size, "%4.4s %ux%u%s%s%s%s%s%s%s%s%s%s%s %u\n%s",
+		 (const char *)&vd->fmt.i_chroma,
+		 vd->fmt.i_width, vd->fmt.i_height,
+		 sys->luma_only ? " luma" : "", sys->is_inset ? " inset" : "",
+		 sys->ivtc ? " ivtc" : "", sys->stats ? " stats" : "",
+		 sys->analytics ? " analytics" : "",
+		 sys->autocrop ? " autocrop" : "",
+		 sys->metrics ? " metrics" : "", sys->wall ? " wall" : "",
+		 sys->dmabufs ? " dmabuf" : "",
+#ifdef HAVE_XCB_PRESENT
+		 sys->present ? " present" : "",
+#else
+		 "",
+#endif
+		 gl->sharpen > 0.f ? " sharpen" : "", gl->chain_len,
+		 gl->defines);
+}
 
-	if (shader_init(&gl->deint, SHADER_TYPE_DEINT_LINEAR) < 0) {
-		fprintf(stderr, "ERR: %s: shader_init(DEINT)\n", __func__);
-		goto cleanup;
-	}
+static int soak_compare(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
 
-	gl->tex[Y_PLANE].id = texture_create(GL_NEAREST);
-	gl->tex[Y_PLANE].loc = glGetUniformLocation(gl->deint.program, "s_ytex");
+	return (x > y) - (x < y);
+}
 
-	gl->tex[U_PLANE].id = texture_create(GL_NEAREST);
-	gl->tex[U_PLANE].loc = glGetUniformLocation(gl->deint.program, "s_utex");
+static void soak_fail(vout_display_sys_t *sys, const char *what)
+{
+	fprintf(stderr, "ERR: soak: FAILED, %s drifted\n", what);
+	sys->soak->failures++;
+}
 
-	gl->tex[V_PLANE].id = texture_create(GL_NEAREST);
-	gl->tex[V_PLANE].loc = glGetUniformLocation(gl->deint.program, "s_vtex");
+static void soak_report(vout_display_sys_t *sys)
+{
+	soak_t *soak = sys->soak;
+	const unsigned n = soak->count;
+	const long rss = soak_rss();
+	const int objects = gl_objects;
+	char key[SOAK_KEY];
+	unsigned i;
+	uint32_t p50, p95, p99;
+
+	qsort(soak->samples, n, sizeof(*soak->samples), soak_compare);
+	p50 = soak->samples[n / 2];
+	p95 = soak->samples[n * 95 / 100];
+	p99 = soak->samples[n * 99 / 100];
+
+	soak->windows++;
+	fprintf(stderr, "MSG: soak: window %u, %u frames, p50 %"PRIu32"us "
+		"p95 %"PRIu32"us p99 %"PRIu32"us max %"PRIu32"us, rss %ldkB, "
+		"%d GL objects\n", soak->windows, n, p50, p95, p99,
+		soak->samples[n - 1], rss, objects);
+
+	/* the first window still warms up caches and the driver */
+	if (soak->windows < 2)
+		return;
 
-	if (shader_init(&gl->scale, SHADER_TYPE_COPY) < 0) {
-		fprintf(stderr, "ERR: %s: shader_init(SCALE)\n", __func__);
-		goto cleanup;
+	if (!soak->base_p99)
+		soak->base_p99 = p99;
+	else if (p99 > soak->base_p99 * 3 / 2 + 1000)
+		soak_fail(sys, "frame time");
+
+	soak_key(sys, key, sizeof(key));
+	vlc_mutex_lock(&soak_base.lock);
+	for (i = 0; i < soak_base.count; i++)
+		if (!strcmp(soak_base.base[i].key, key))
+			break;
+	if (i == soak_base.count) {
+		if (i == SOAK_BASES) {
+			vlc_mutex_unlock(&soak_base.lock);
+			fprintf(stderr, "MSG: soak: too many configurations, "
+				"no baseline\n");
+			return;
+		}
+		strcpy(soak_base.base[i].key, key);
+		soak_base.base[i].rss     = rss;
+		soak_base.base[i].objects = objects;
+		soak_base.count++;
 	}
-	gl->rgb_tex.loc = glGetUniformLocation(gl->scale.program, "s_tex");
+	if (rss > soak_base.base[i].rss + 32 * 1024)
+		soak_fail(sys, "resident memory");
+	/* present pixmaps come and go */
+	if (objects > soak_base.base[i].objects + 16)
+		soak_fail(sys, "GL object count");
+	vlc_mutex_unlock(&soak_base.lock);
+}
 
-	/* The rest is done when pool is requested */
+/* alternate between the original and half its size */
+static void soak_resize(vout_display_sys_t *sys)
+{
+	const soak_t *soak = sys->soak;
+	x11_backend_t *x11 = sys->x11;
+	unsigned width = soak->size.width, height = soak->size.height;
 
-#if GL_UNPACK_ROW_LENGTH
-	/* check for extentions we can use */
-	{
-		const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
-		fprintf(stderr, "MSG: available extentions:\n   %s\n", extensions);
+	if (!x11 || x11->external || !width || !height)
+		return;
 
-		gl->has_unpack_row = opengl_have_extention(extensions, "GL_EXT_unpack_subimage");
-		fprintf(stderr, "MSG: have %sunpack_row support\n",
-			gl->has_unpack_row ? "" : "no ");
+	if (x11->rect.width == width && x11->rect.height == height) {
+		width  = MAX(width / 2, 64);
+		height = MAX(height / 2, 64);
 	}
-#endif
+	fprintf(stderr, "MSG: soak: resizing to %ux%u\n", width, height);
+	XResizeWindow(x11->display, x11->window, width, height);
+	XFlush(x11->display);
+}
 
-	*p_gl = gl;
-	return VLC_SUCCESS;
+static void soak_add_frame(vout_display_sys_t *sys, mtime_t duration)
+{
+	soak_t *soak = sys->soak;
+	const mtime_t now = mdate();
 
-cleanup:
-	shader_delete(&gl->deint);
-	shader_delete(&gl->scale);
+	if (!soak)
+		return;
 
-	free(gl);
-	gl = NULL;
-	return VLC_EGENERIC;
+	if (soak->count < SOAK_SAMPLES)
+		soak->samples[soak->count++] = MIN(duration, UINT32_MAX);
+	if (now < soak->window_end)
+		return;
+
+	if (soak->count) {
+		soak_report(sys);
+		if (soak->windows % SOAK_RESIZE == 0)
+			soak_resize(sys);
+	}
+	soak->count = 0;
+	soak->window_end = now + SOAK_WINDOW;
 }
 
 static picture_pool_t *do_pool(vout_display_t *, unsigned count);
@@ -884,6 +5546,13 @@ static int Open(vlc_object_t *object)
 	vout_display_t *vd = (vout_display_t *)object;
 	vout_display_sys_t *sys;
 	vout_window_cfg_t *cfg;
+	GLubyte *lut = NULL;
+	unsigned lut_size = 0;
+	char *lut_path, *metrics_path, *wall_tile;
+	char defines[128];
+	float denoise, sharpen, hdr_peak;
+	enum hdr_transfer hdr;
+	bool yuv2020, gamut2020;
 
 	vd->sys = sys = calloc(1, sizeof(*sys));
 	if (!sys)
@@ -905,23 +5574,105 @@ static int Open(vlc_object_t *object)
 	}
 	cfg->type = VOUT_WINDOW_TYPE_XID;
 
-	if (x11_backend_create(&sys->x11, cfg, vd) != VLC_SUCCESS) {
-		fprintf(stderr, "ERR: %s: failed to create x11\n", __func__);
-		goto cleanup;
+	if (var_InheritBool(vd, "gles2-pip")) {
+		if (pip_attach(sys) != VLC_SUCCESS) {
+			fprintf(stderr, "ERR: %s: failed to attach inset\n", __func__);
+			goto cleanup;
+		}
+	} else {
+		if (x11_backend_create(&sys->x11, cfg, vd) != VLC_SUCCESS) {
+			fprintf(stderr, "ERR: %s: failed to create x11\n", __func__);
+			goto cleanup;
+		}
+		if (egl_backend_create(&sys->egl, sys->x11,
+				       var_InheritBool(vd, "gles2-low-latency"))
+		    != VLC_SUCCESS) {
+			fprintf(stderr, "ERR: %s: failed to create egl\n", __func__);
+			goto cleanup;
+		}
+#ifdef HAVE_XRANDR
+		if (var_InheritBool(vd, "gles2-refresh-match"))
+			x11_refresh_match(sys->x11, &vd->source);
+#endif
 	}
-	if (egl_backend_create(&sys->egl, sys->x11) != VLC_SUCCESS) {
-		fprintf(stderr, "ERR: %s: failed to create egl\n", __func__);
-		goto cleanup;
+	lut_path = var_InheritString(vd, "gles2-lut");
+	if (lut_path) {
+		lut = lut_load(lut_path, &lut_size);
+		free(lut_path);
 	}
-	if (opengl_es2_create(&sys->gl) != VLC_SUCCESS) {
+	/* an inset swaps its output with the main one, it has no history */
+	denoise = sys->is_inset ? 0.f : var_InheritFloat(vd, "gles2-denoise");
+	hdr = hdr_detect(vd, &hdr_peak);
+	bt2020_detect(vd, hdr, &yuv2020, &gamut2020);
+	snprintf(defines, sizeof(defines), "%s%s%s%s%s",
+		 lut ? "#define LUT\n" : "",
+		 denoise > 0.f ? "#define DENOISE\n" : "",
+		 hdr == HDR_PQ ? "#define PQ\n" :
+		 hdr == HDR_HLG ? "#define HLG\n" : "",
+		 yuv2020 ? "#define YUV2020\n" : "",
+		 gamut2020 ? "#define GAMUT2020\n" : "");
+	if (opengl_es2_create(&sys->gl, defines) != VLC_SUCCESS) {
 		fprintf(stderr, "ERR: %s: failed to create gles2\n", __func__);
+		free(lut);
 		goto cleanup;
 	}
-
-	update_bounding_box(vd->cfg, &sys->x11->rect, &sys->gl->viewport);
+	if (lut) {
+		lut_upload(sys->gl, lut, lut_size);
+		free(lut);
+	}
+	if (denoise > 0.f)
+		denoise_setup(sys->gl, denoise);
+	if (hdr != HDR_NONE)
+		hdr_setup(sys->gl, hdr_peak);
+	sharpen = var_InheritFloat(vd, "gles2-sharpen");
+	if (sharpen > 0.f && sharpen_setup(sys->gl, sharpen) != VLC_SUCCESS)
+		fprintf(stderr, "ERR: %s: no sharpening\n", __func__);
+	sys->flat_chroma_check = var_InheritBool(vd, "gles2-flat-chroma");
+	if (sched_create(sys) != VLC_SUCCESS)
+		fprintf(stderr, "ERR: %s: no scheduling options\n", __func__);
+	metrics_path = var_InheritString(vd, "gles2-metrics");
+	if (metrics_path && metrics_create(sys, metrics_path) != VLC_SUCCESS)
+		fprintf(stderr, "ERR: %s: no metrics\n", __func__);
+	if (var_InheritBool(vd, "gles2-soak") && soak_create(sys) != VLC_SUCCESS)
+		fprintf(stderr, "ERR: %s: no soak test\n", __func__);
+	if (var_InheritBool(vd, "gles2-ivtc") &&
+	    ivtc_create(sys) != VLC_SUCCESS)
+		fprintf(stderr, "ERR: %s: no inverse telecine\n", __func__);
+	if (var_InheritBool(vd, "gles2-analytics") &&
+	    analytics_create(sys) != VLC_SUCCESS)
+		fprintf(stderr, "ERR: %s: no analytics\n", __func__);
+
+	if (!sys->is_inset) {
+		if (var_InheritBool(vd, "gles2-stats") &&
+		    stats_create(sys) != VLC_SUCCESS)
+			fprintf(stderr, "ERR: %s: no statistics\n", __func__);
+
+		shader_chain_load(sys->gl, var_InheritString(vd, "gles2-shader-chain"));
+		wall_tile = var_InheritString(vd, "gles2-wall");
+		if (wall_tile) {
+			if (wall_create(sys, wall_tile) != VLC_SUCCESS)
+				fprintf(stderr, "ERR: %s: no video wall\n",
+					__func__);
+			free(wall_tile);
+		}
+		/* the screens of a wall would crop differently */
+		if (var_InheritBool(vd, "gles2-autocrop") && !sys->wall &&
+		    autocrop_create(sys) != VLC_SUCCESS)
+			fprintf(stderr, "ERR: %s: no autocrop\n", __func__);
+
+		update_viewports(sys, vd->cfg);
+		pip_register_host(sys);
+
+#ifdef HAVE_XCB_PRESENT
+		if (var_InheritBool(vd, "gles2-present") &&
+		    present_create(sys) != VLC_SUCCESS)
+			fprintf(stderr, "ERR: %s: Present unusable, swapping\n",
+				__func__);
+#endif
+	}
 
 	/* p_vd->info is not modified */
-	vd->fmt.i_chroma = VLC_CODEC_I420;
+	vd->fmt.i_chroma = negotiate_chroma(vd);
 
 	vd->pool    = do_pool;
 	vd->prepare = NULL;
@@ -932,9 +5683,19 @@ static int Open(vlc_object_t *object)
 	return VLC_SUCCESS;
 
 cleanup:
+	pip_detach(sys);
+	stats_destroy(sys);
+	analytics_destroy(sys);
+	autocrop_destroy(sys);
+	sched_destroy(sys);
+	metrics_destroy(sys);
+	soak_destroy(sys);
+	wall_destroy(sys);
 	opengl_es2_destroy(sys->gl);
 	egl_backend_destroy(sys->egl);
 	x11_backend_destroy(sys->x11);
+	pip_release(sys);
+	free(sys->ivtc);
 	free(sys);
 	return VLC_EGENERIC;
 }
@@ -944,12 +5705,29 @@ static void Close(vlc_object_t *object)
 	vout_display_t *vd = (vout_display_t *)object;
 	vout_display_sys_t *sys = vd->sys;
 
+	pip_detach(sys);
+#ifdef HAVE_XCB_PRESENT
+	present_destroy(sys);
+#endif
+#ifdef HAVE_LINUX_UDMABUF_H
+	dmabuf_release_imports(sys);
+#endif
+	stats_destroy(sys);
+	analytics_destroy(sys);
+	autocrop_destroy(sys);
+	sched_destroy(sys);
+	metrics_destroy(sys);
+	soak_destroy(sys);
+	wall_destroy(sys);
 	opengl_es2_destroy(sys->gl);
 	egl_backend_destroy(sys->egl);
 	x11_backend_destroy(sys->x11);
+	pip_release(sys);
 
 	if (sys->pool)
 		picture_pool_Delete(sys->pool);
+	free(sys->dmabufs);
+	free(sys->ivtc);
 
 	free(sys);
 	sys = NULL;
@@ -974,24 +5752,113 @@ static picture_pool_t *do_pool(vout_display_t *vd, unsigned count)
 	if (!sys->pool) {
 		opengl_es2_t *gl = sys->gl;
 
-		sys->pool = picture_pool_NewFromFormat(&vd->fmt, count);
+#ifdef HAVE_LINUX_UDMABUF_H
+		/* inverse telecine keeps the previous planes around */
+		if (var_InheritBool(vd, "gles2-dmabuf") && !sys->ivtc)
+			sys->pool = dmabuf_pool_create(sys, count);
+#endif
+		if (!sys->pool)
+			sys->pool = picture_pool_NewFromFormat(&vd->fmt, count);
 
 		/* create the framebuffer and the corresponding texture */
-		glGenFramebuffers(1, &gl->framebuffer);
+		framebuffer_create(&gl->framebuffer, &gl->rgb_tex.id,
+				   vd->fmt.i_width, vd->fmt.i_height);
+		gl->output_tex = gl->rgb_tex.id;
+
+		/* both start black, either may be the first history */
+		if (gl->denoise > 0.f) {
+			glClear(GL_COLOR_BUFFER_BIT);
+			framebuffer_create(&gl->hist_framebuffer, &gl->hist_tex,
+					   vd->fmt.i_width, vd->fmt.i_height);
+			glClear(GL_COLOR_BUFFER_BIT);
+		}
+		gl->crop.x = gl->crop.y = 0;
+		gl->crop.width = vd->fmt.i_width;
+		gl->crop.height = vd->fmt.i_height;
+		if (sys->wall) {
+			wall_crop(sys);
+			update_viewports(sys, vd->cfg);
+		}
 
-		gl->rgb_tex.id = texture_create(GL_LINEAR);
+		if (sys->is_inset)
+			framebuffer_create(&gl->back_framebuffer, &gl->back_tex,
+					   vd->fmt.i_width, vd->fmt.i_height);
 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,
-			     vd->fmt.i_width, vd->fmt.i_height,
-			     0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+		/* the scaler samples pictures of the source size */
+		if (gl->sharpen > 0.f) {
+			glUseProgram(gl->scale.program);
+			glUniform2f(glGetUniformLocation(gl->scale.program,
+							 "texel_size"),
+				    1.0 / vd->fmt.i_width, 1.0 / vd->fmt.i_height);
+		}
 
-		glBindFramebuffer(GL_FRAMEBUFFER, gl->framebuffer);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-				       GL_TEXTURE_2D, gl->rgb_tex.id, 0);
+		/* post-processing targets, only if there is something to run */
+		if (gl->chain_len) {
+			for (unsigned i = 0; i < 2; i++)
+				framebuffer_create(&gl->chain_framebuffer[i],
+						   &gl->chain_tex[i],
+						   vd->fmt.i_width, vd->fmt.i_height);
+			gl->chain_texel[0] = 1.0 / vd->fmt.i_width;
+			gl->chain_texel[1] = 1.0 / vd->fmt.i_height;
+		}
+
+		opengl_es2_set_chroma(sys);
+		opengl_es2_warmup(sys);
 	}
 	return sys->pool;
 }
 
+#define STEADY_STATE_FRAMES 100
+
+/*
+ * In low latency mode the frame is finished before do_display() returns,
+ * so the time since it arrived is what it took to reach the glass, up to
+ * the scanout.
+ */
+static void update_latency(vout_display_sys_t *sys, const picture_t *p,
+			   mtime_t start)
+{
+	const mtime_t now = mdate();
+
+	sys->latency_frames++;
+	sys->latency_sum += now - start;
+	sys->latency_max = MAX(sys->latency_max, now - start);
+	sys->late_sum += now - p->date;
+
+	if (now < sys->latency_report)
+		return;
+
+	fprintf(stderr, "MSG: low latency: %u frames, arrival to glass avg "
+		"%"PRId64"us max %"PRId64"us, %"PRId64"us after their date\n",
+		sys->latency_frames, sys->latency_sum / sys->latency_frames,
+		sys->latency_max, sys->late_sum / sys->latency_frames);
+	sys->latency_frames = 0;
+	sys->latency_sum = sys->latency_max = sys->late_sum = 0;
+	sys->latency_report = now + CLOCK_FREQ;
+}
+
+static void update_frame_timing(vout_display_sys_t *sys, mtime_t duration)
+{
+	sys->frames++;
+	if (sys->frames == 1) {
+		sys->first_frame = duration;
+		fprintf(stderr, "MSG: first frame took %"PRId64"us\n", duration);
+		return;
+	}
+
+	/* skip the first frames, they may still hit lazy driver work */
+	if (sys->frames < STEADY_STATE_FRAMES / 2)
+		return;
+	if (sys->steady == 0)
+		sys->steady = duration;
+	sys->steady = sys->steady * 0.9 + duration * 0.1;
+
+	if (sys->frames == STEADY_STATE_FRAMES)
+		fprintf(stderr, "MSG: steady state %"PRId64"us per frame, "
+			"first frame %"PRId64"us (%.1fx)\n", sys->steady,
+			sys->first_frame, (double)sys->first_frame / sys->steady);
+}
+
 /*
  * Display a picture and an optional subpicture (mandatory).
  *
@@ -1007,25 +5874,100 @@ static void do_display(vout_display_t *vd, picture_t *p, subpicture_t *sp)
 {
 	vout_display_sys_t *sys = vd->sys;
 	egl_backend_t *egl = sys->egl;
+	mtime_t start = mdate();
+	mtime_t stage[STAGE_COUNT];
 #if MEASURE_TIME
 	static int64_t time = 0;
 	int64_t t;
 
 	t = libvlc_clock();
 #endif
-	if (p->format.i_chroma != VLC_CODEC_I420 || p->i_planes != 3) {
+	sched_begin(sys);
+	if (!is_supported_chroma(p->format.i_chroma)) {
 		fprintf(stderr, "ERR: unsupported picture format: %s\n",
 			vlc_fourcc_GetDescription(UNKNOWN_ES, p->format.i_chroma));
-		return;
+		metrics_drop(sys);
+		stats_drop(sys);
+		goto out;
+	}
+
+	/* an inset only converts, the main output shows it */
+	if (sys->is_inset) {
+		if (do_conversion(sys, p)) {
+			pip_publish(sys);
+			metrics_add_frame(sys, p, NULL);
+		} else {
+			metrics_drop(sys);
+		}
+		goto out;
 	}
 
 	/* do event handling stuff */
 	x11_backend_handle_events(sys);
-	/* do the rendering */
-	do_deinterlace_and_color_conversion(sys, p);
-	do_scaling(sys, p);
-	/* do the acutall drawing */
-	eglSwapBuffers(egl->display, egl->surface);
+	/* do the rendering, 3:2 repeats are not shown at all */
+	if (!do_conversion(sys, p)) {
+		metrics_drop(sys);
+		stats_drop(sys);
+		goto out;
+	}
+	stage[STAGE_CONVERT] = mdate();
+	sys->gl->output_tex = do_postprocess(sys, sys->gl->rgb_tex.id);
+	stage[STAGE_POST] = mdate();
+#ifdef HAVE_XCB_PRESENT
+	if (sys->present) {
+		present_frame(sys, p);
+	} else
+#endif
+	{
+		do_scaling(sys, &sys->gl->viewport);
+		stats_draw(sys);
+		wall_sync(sys);
+		/* do the acutall drawing */
+		eglSwapBuffers(egl->display, egl->surface);
+		/* never queue a second frame behind this one */
+		if (egl->latency != LATENCY_NORMAL)
+			glFinish();
+	}
+	if (egl->latency != LATENCY_NORMAL)
+		update_latency(sys, p, start);
+	stage[STAGE_SCALE] = mdate() - stage[STAGE_POST];
+	stage[STAGE_POST] -= stage[STAGE_CONVERT];
+	stage[STAGE_CONVERT] -= start;
+	stats_add_frame(sys, p, stage);
+	metrics_add_frame(sys, p, stage);
+
+	/* the converted picture is reused for every cloned window */
+	if (sys->x11->num_clones) {
+		for (unsigned i = 0; i < sys->x11->num_clones; i++) {
+			eglMakeCurrent(egl->display, egl->clones[i],
+				       egl->clones[i], egl->context);
+			do_scaling(sys, &sys->gl->clone_viewport[i]);
+			eglSwapBuffers(egl->display, egl->clones[i]);
+		}
+		eglMakeCurrent(egl->display, egl->surface, egl->surface,
+			       egl->context);
+	}
+
+	/* every output has been drawn, the intermediate pictures are done */
+	if (sys->gl->discard_framebuffer) {
+		/* with the denoiser, the picture is the next history */
+		framebuffer_discard(sys->gl, sys->gl->hist_tex ?
+				    sys->gl->hist_framebuffer :
+				    sys->gl->framebuffer);
+		for (unsigned i = 0; i < 2 && sys->gl->chain_len; i++)
+			framebuffer_discard(sys->gl,
+					    sys->gl->chain_framebuffer[i]);
+	}
+
+out:
+	update_frame_timing(sys, mdate() - start);
+	soak_add_frame(sys, mdate() - start);
+	sched_end(sys, p);
+#ifdef HAVE_LINUX_UDMABUF_H
+	/* back to the decoder once released */
+	if (p->p_sys && p->p_sys->owner == sys)
+		dmabuf_cpu_access(p->p_sys, true);
+#endif
 
 	picture_Release(p);
 	if (sp)
@@ -1059,7 +6001,12 @@ static int do_control(vout_display_t *vd, int query, va_list args)
 	case VOUT_DISPLAY_CHANGE_SOURCE_ASPECT: {
 		const vout_display_cfg_t *cfg = va_arg(args, const vout_display_cfg_t *);
 		fprintf(stderr, "MSG: VOUT_DISPLAY_CHANGE_DISPLAY_SIZE\n");
-		update_bounding_box(cfg, &vout->x11->rect, &vout->gl->viewport);
+		if (vout->metrics && query == VOUT_DISPLAY_CHANGE_DISPLAY_SIZE)
+			atomic_fetch_add_explicit(&vout->metrics->resizes, 1,
+						  memory_order_relaxed);
+		if (vout->is_inset)
+			return VLC_SUCCESS;
+		update_viewports(vout, cfg);
 		} return VLC_SUCCESS;
 
 	default: